@@ -16,6 +16,7 @@
 #include <allegro5/allegro_color.h>
 
 #include <string.h>
+#include <stdatomic.h>
 
 extern ALLEGRO_TRANSFORM identity_transform;
 
@@ -98,6 +99,9 @@ enum background_mode
 	BACKGROUND_INVALID
 } background_mode;
 
+// Mode requested from lua, applied on the next draw.
+static atomic_int background_target;
+
 static struct {
 	const char* name;
 	void (*draw)();
@@ -138,8 +142,18 @@ static int lua_backgroundmode(lua_State* L)
 	if (target_mode == BACKGROUND_INVALID)
 		return -1;
 
+	atomic_store(&background_target, target_mode);
+
+	return 0;
+}
+
+// Mode changes create and destroy bitmaps so they happen where drawing does, which may be a render thread.
+static void background_transition()
+{
+	const enum background_mode target_mode = atomic_load(&background_target);
+
 	if (target_mode == background_mode)
-		return 0;
+		return;
 
 	if (mode_table[background_mode].exit)
 		mode_table[background_mode].exit();
@@ -149,12 +163,14 @@ static int lua_backgroundmode(lua_State* L)
 
 	background_mode = target_mode;
 
-	return 0;
+	// Entering can retarget drawing, put it back on the backbuffer.
+	al_set_target_backbuffer(al_get_current_display());
 }
 
 void background_init(lua_State* L, ALLEGRO_DISPLAY* display)
 {
 	background_mode = BACKGROUND_ALEX;
+	atomic_store(&background_target, background_mode);
 
 	if(mode_table[background_mode].enter)
 		mode_table[background_mode].enter();
@@ -165,6 +181,8 @@ void background_init(lua_State* L, ALLEGRO_DISPLAY* display)
 
 void background_draw()
 {
+	background_transition();
+
 	al_use_transform(&identity_transform);
 	material_apply(NULL);
 
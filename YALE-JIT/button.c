@@ -46,12 +46,20 @@ static void mask(const struct wg_base* const wg)
 		al_map_rgb(255, 255, 255));
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	const struct button* const button = (const struct button* const)wg;
+
+	return wg_hit_rounded_rectangle(wg, button->pallet->edge_radius, x, y);
+}
+
 const struct wg_jumptable_hud button_jumptable =
 {
 	.type = "button",
 		
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 };
 
 int button_new(lua_State* L)
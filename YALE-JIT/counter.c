@@ -62,6 +62,13 @@ static void mask(const struct wg_base* const wg)
 		al_map_rgb(255, 0, 0));
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	const struct counter* const counter = (const struct counter* const)wg;
+
+	return wg_hit_rounded_rectangle(wg, counter->pallet->edge_radius, x, y);
+}
+
 static int set(lua_State* L)
 {
 	struct counter* const counter = (struct counter* const)check_widget_lua(-2, &counter_jumptable);
@@ -138,6 +145,7 @@ const struct wg_jumptable_hud counter_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 
 	.index = index,
 	.newindex = newindex,
@@ -89,6 +89,23 @@ static void mask(const struct wg_base* const wg)
 
 }
 
+// Matches the mask, the option list below the box counts while it's open.
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	const struct drop_down* const drop_down = (const struct drop_down* const)wg;
+	const double radius = drop_down->pallet->edge_radius;
+
+	if (wg_hit_rounded_box(wg->hw, wg->hh, radius, x, y))
+		return true;
+
+	if (drop_down->hud_state != HUD_ACTIVE)
+		return false;
+
+	const double half_list = 25.0 * drop_down->option_cnt;
+
+	return wg_hit_rounded_box(wg->hw - 2, wg->hh + half_list, radius, x, y - half_list);
+}
+
 static void left_click(struct wg_base* const wg)
 {
 	struct drop_down* const drop_down = (const struct drop_down* const)wg;
@@ -168,6 +185,7 @@ const struct wg_jumptable_hud drop_down_jumptable =
 		
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 	.left_click = left_click,
 	.click_off = click_off,
 
@@ -36,12 +36,20 @@ static void mask(const struct wg_base* const wg)
 		al_map_rgb(255, 255, 255));
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	const struct frame* const frame = (const struct frame* const)wg;
+
+	return wg_hit_rounded_rectangle(wg, frame->pallet->edge_radius, x, y);
+}
+
 const struct wg_jumptable_hud frame_jumptable =
 {
 	.type = "frame",
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 };
 
 int frame_new(lua_State* L)
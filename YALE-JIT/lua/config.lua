@@ -9,6 +9,24 @@
 --	boot_file: the file path for an alternative boot file
 --	video_adapter: which video adapter will be used to create the display
 --	windowed: whether or not the display is windowed
---	thread_pool_size: the number of worker threads in the thread pool
+--	idle_mode: whether the main loop sleeps until input or the next timer when nothing is animating
+--		shader effects that animate with time freeze while idle
+--	event_mode: "coalesce" to handle all of a frame's input with one widget update (default) or "exact" to update to each event's timestamp, for replay fidelity
+--	simulation_rate: widget updates per second for a fixed timestep, drawing interpolates between the last two updates
+--		unset for one variable length update per frame (default), a fixed rate implies the "coalesce" event_mode
+--	render_thread: whether drawing moves to its own thread, drawing one frame while the next is simulated
+--		hover and drop targets then lag the mouse by a frame or two
+--	profiler_frames: number of frames of phase timings kept by the frame profiler, unset to disable it
+--		F3 toggles the overlay, F4 or profiler_dump([file_name]) writes the history to csv
+--	trace_file: file to write a chrome trace of main loop phases, thread pool jobs, timers and widget callbacks to, unset to disable tracing
+--		open in chrome://tracing or ui.perfetto.dev, trace_flush() writes what has been recorded so far
+--	thread_pool_size: the number of worker threads in the thread pool, or "auto" to use one less than the online cpus (default)
+--	thread_pool_grain: the number of widgets updated per thread pool job
+--	thread_pool_spin: microseconds an idle worker spins looking for work before sleeping
+--	thread_pool_affinity: whether each worker thread is pinned to its own cpu
+--	thread_pool_background_budget: milliseconds of background work the workers may run per frame, 0 for no limit
+--	scheduler_backend: "heap" for exact timer order (default) or "wheel" for a timing wheel, better with many timers
+--	scheduler_resolution: milliseconds per timing wheel slot, timers may fire this late
+--	scheduler_dispatch: "event" to run each timer as its own event (default) or "batch" to run all due timers with one widget update
 
 print("Config Complete")
@@ -4,6 +4,7 @@
 
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_primitives.h>
@@ -23,26 +24,50 @@
 
 // Thread Pool includes
 #include "thread_pool.h"
-void thread_pool_create(int);
+bool thread_pool_create(const struct thread_pool_config*);
 void thread_pool_destroy();
+void thread_pool_frame_reset();
 
 // Widget Interface includes
 void widget_engine_init();
 void widget_engine_draw();
-struct work_queue* widget_engine_widget_work();
+void widget_engine_widget_work(struct thread_pool_fence*);
 void widget_engine_update();
+bool widget_engine_idle();
+void widget_engine_refresh_hover();
 void widget_engine_event_handler();
 void widget_interface_shader_predraw();
+void widget_engine_snapshot_picking();
+void widget_engine_snapshot(size_t);
+void widget_engine_snapshot_predraw(size_t);
+void widget_engine_snapshot_draw(size_t);
+void widget_engine_snapshot_pick(size_t);
 
 // Miscellaneous Lua Interfaces
 void lua_openL_misc(lua_State*);
+void lua_openL_thread_pool(lua_State*);
 
 // Resource Manager includes
 void resource_manager_init();
 
 // Scheduler includes
-ALLEGRO_EVENT_SOURCE* scheduler_init();
+#include "scheduler.h"
+ALLEGRO_EVENT_SOURCE* scheduler_init(const struct scheduler_config*);
 void scheduler_generate_events();
+size_t scheduler_batch_collect(double);
+void scheduler_batch_run();
+double scheduler_idle_deadline();
+
+// Profiler includes
+#include "profiler.h"
+void lua_openL_profiler(lua_State*);
+
+// Trace includes
+#include "trace.h"
+void lua_openL_trace(lua_State*);
+
+// Particle includes
+size_t particle_live_cnt();
 
 // Background includes
 void background_init();
@@ -53,6 +78,16 @@ static ALLEGRO_DISPLAY* display;
 static ALLEGRO_EVENT_QUEUE* main_event_queue;
 struct thread_pool* thread_pool;
 static bool do_exit;
+static bool idle_mode;
+static bool coalesce_events;
+static size_t step_cnt;
+
+// Render thread, owns the display while running and draws the snapshot in render_pending
+static ALLEGRO_THREAD* render_thread;
+static ALLEGRO_MUTEX* render_mutex;
+static ALLEGRO_COND* render_cond;
+static int render_pending;
+static size_t render_back;
 
 // A simple FPS Monitor
 #ifdef EASY_FPS
@@ -67,6 +102,7 @@ double future_timestamp;
 double current_timestamp;
 double residual_timestamp;
 double delta_timestamp;
+double step_timestamp;
 
 ALLEGRO_TRANSFORM identity_transform;
 ALLEGRO_FONT* debug_font;
@@ -278,19 +314,204 @@ static inline int allegro_init()
     return 1;
 }
 
-// Wrapp thread_pool_init to read size from config.
-static void thread_pool_init()
+// Read the main loop settings from config.
+static void main_loop_init()
 {
-    lua_getglobal(lua_state, "thread_pool_size");
+    lua_getglobal(lua_state, "idle_mode");
 
-    const int size = lua_isnumber(lua_state, -1)? luaL_checkint(lua_state, -1): 8;
+    idle_mode = lua_toboolean(lua_state, -1);
 
     lua_pop(lua_state, 1);
 
-    thread_pool_create(size);
+    lua_pushnil(lua_state);
+    lua_setglobal(lua_state, "idle_mode");
+
+    lua_getglobal(lua_state, "event_mode");
+
+    const char* event_mode = lua_tostring(lua_state, -1);
+    coalesce_events = !event_mode || strcmp(event_mode, "exact") != 0;
+
+    lua_pop(lua_state, 1);
 
     lua_pushnil(lua_state);
-    lua_setglobal(lua_state, "thread_pool_size");
+    lua_setglobal(lua_state, "event_mode");
+
+    lua_getglobal(lua_state, "simulation_rate");
+
+    const double simulation_rate = lua_tonumber(lua_state, -1);
+    step_timestamp = simulation_rate > 0 ? 1.0 / simulation_rate : 0;
+
+    lua_pop(lua_state, 1);
+
+    lua_pushnil(lua_state);
+    lua_setglobal(lua_state, "simulation_rate");
+
+    // Events can only land on step boundaries.
+    if (step_timestamp > 0)
+        coalesce_events = true;
+
+    lua_getglobal(lua_state, "render_thread");
+
+    if (lua_toboolean(lua_state, -1))
+    {
+        render_mutex = al_create_mutex();
+        render_cond = al_create_cond();
+        render_pending = -1;
+    }
+
+    lua_pop(lua_state, 1);
+
+    lua_pushnil(lua_state);
+    lua_setglobal(lua_state, "render_thread");
+
+    lua_getglobal(lua_state, "profiler_frames");
+
+    profiler_init(lua_tointeger(lua_state, -1));
+
+    lua_pop(lua_state, 1);
+
+    lua_pushnil(lua_state);
+    lua_setglobal(lua_state, "profiler_frames");
+
+    lua_getglobal(lua_state, "trace_file");
+
+    trace_init(lua_tostring(lua_state, -1));
+    trace_thread_name("main", -1);
+
+    lua_pop(lua_state, 1);
+
+    lua_pushnil(lua_state);
+    lua_setglobal(lua_state, "trace_file");
+}
+
+// When nothing is animating, no particles are live and no input is pending
+// block until input or the next scheduler deadline instead of drawing identical frames.
+static void idle_wait()
+{
+    if (!idle_mode || !widget_engine_idle() || particle_live_cnt() != 0 ||
+        !al_is_event_queue_empty(main_event_queue))
+        return;
+
+    const double deadline = scheduler_idle_deadline();
+    const double wait = deadline - al_get_time();
+
+    if (wait <= 0)
+        return;
+
+    if (isinf(wait))
+        al_wait_for_event(main_event_queue, NULL);
+    else
+    {
+        ALLEGRO_TIMEOUT timeout;
+        al_init_timeout(&timeout, wait);
+        al_wait_for_event_until(main_event_queue, NULL, &timeout);
+    }
+
+    // Nothing moved while waiting, so skip the clock over the wait rather than catching up a quarter second a pass.
+    ALLEGRO_EVENT next_event;
+    const double woken_timestamp = al_peek_next_event(main_event_queue, &next_event) ?
+        next_event.any.timestamp : al_get_time();
+
+    if (woken_timestamp > current_timestamp)
+        current_timestamp = woken_timestamp;
+}
+
+// Wrapp scheduler_init to read its settings from config.
+static ALLEGRO_EVENT_SOURCE* scheduler_init_from_config()
+{
+    static const char* const settings[] = {
+        "scheduler_backend",
+        "scheduler_resolution",
+        "scheduler_dispatch",
+    };
+
+    struct scheduler_config config = {
+        .backend = SCHEDULER_HEAP,
+        .resolution = 0.001,
+        .batch = false,
+    };
+
+    for (size_t i = 0; i < 3; i++)
+        lua_getglobal(lua_state, settings[i]);
+
+    if (lua_isstring(lua_state, -3) && !strcmp(lua_tostring(lua_state, -3), "wheel"))
+        config.backend = SCHEDULER_WHEEL;
+
+    // The resolution is given in milliseconds.
+    if (lua_isnumber(lua_state, -2))
+        config.resolution = 0.001 * lua_tonumber(lua_state, -2);
+
+    if (lua_isstring(lua_state, -1) && !strcmp(lua_tostring(lua_state, -1), "batch"))
+        config.batch = true;
+
+    lua_pop(lua_state, 3);
+
+    ALLEGRO_EVENT_SOURCE* const event_source = scheduler_init(&config);
+
+    for (size_t i = 0; i < 3; i++)
+    {
+        lua_pushnil(lua_state);
+        lua_setglobal(lua_state, settings[i]);
+    }
+
+    return event_source;
+}
+
+// Wrapp thread_pool_init to read its settings from config.
+static int thread_pool_init()
+{
+    static const char* const settings[] = {
+        "thread_pool_size",
+        "thread_pool_grain",
+        "thread_pool_spin",
+        "thread_pool_affinity",
+        "thread_pool_background_budget",
+    };
+
+    // A size of 0 means auto, the pool sizes itself from the online cpus.
+    struct thread_pool_config config = {
+        .thread_cnt = 0,
+        .grain = 256,
+        .spin_us = 50,
+        .affinity = false,
+        .background_budget_us = 4000,
+    };
+
+    for (size_t i = 0; i < 5; i++)
+        lua_getglobal(lua_state, settings[i]);
+
+    if (lua_type(lua_state, -5) == LUA_TNUMBER)
+        config.thread_cnt = luaL_checkint(lua_state, -5);
+
+    if (lua_isnumber(lua_state, -4))
+        config.grain = luaL_checkint(lua_state, -4);
+
+    if (lua_isnumber(lua_state, -3))
+        config.spin_us = luaL_checkint(lua_state, -3);
+
+    if (!lua_isnil(lua_state, -2))
+        config.affinity = lua_toboolean(lua_state, -2);
+
+    // The budget is given in milliseconds per frame.
+    if (lua_isnumber(lua_state, -1))
+        config.background_budget_us = (int)(1000 * lua_tonumber(lua_state, -1));
+
+    lua_pop(lua_state, 5);
+
+    const bool created = thread_pool_create(&config);
+
+    for (size_t i = 0; i < 5; i++)
+    {
+        lua_pushnil(lua_state);
+        lua_setglobal(lua_state, settings[i]);
+    }
+
+    if (!created) {
+        fprintf(stderr, "failed to create the thread pool!\n");
+        return 0;
+    }
+
+    return 1;
 }
 
 // Initalize the global enviroment.
@@ -325,6 +546,13 @@ static inline void process_event()
             do_exit = true;
             return;
         }
+
+        if (current_event.keyboard.keycode == ALLEGRO_KEY_F3)
+            profiler_toggle_overlay();
+
+        if (current_event.keyboard.keycode == ALLEGRO_KEY_F4)
+            profiler_dump("profile.csv");
+
         break;
 
     case ALLEGRO_EVENT_MOUSE_AXES:
@@ -342,6 +570,62 @@ static inline void process_event()
     widget_engine_event_handler();
 }
 
+// Handle every event due by future_timestamp against the widget state of the last update.
+// Consecutive mouse motion is folded into one event with the final position and summed deltas.
+static inline void drain_events()
+{
+    bool moved = false;
+
+    while (al_peek_next_event(main_event_queue, &current_event)
+        && current_event.any.timestamp <= future_timestamp)
+    {
+        al_drop_next_event(main_event_queue);
+
+        switch (current_event.type)
+        {
+        case ALLEGRO_EVENT_MOUSE_AXES:
+        {
+            ALLEGRO_EVENT next_event;
+
+            while (al_peek_next_event(main_event_queue, &next_event)
+                && next_event.type == ALLEGRO_EVENT_MOUSE_AXES
+                && next_event.any.timestamp <= future_timestamp)
+            {
+                next_event.mouse.dx += current_event.mouse.dx;
+                next_event.mouse.dy += current_event.mouse.dy;
+                next_event.mouse.dz += current_event.mouse.dz;
+                next_event.mouse.dw += current_event.mouse.dw;
+
+                current_event = next_event;
+                al_drop_next_event(main_event_queue);
+            }
+
+            moved = true;
+
+            break;
+        }
+
+        case ALLEGRO_EVENT_MOUSE_BUTTON_DOWN:
+        case ALLEGRO_EVENT_MOUSE_BUTTON_UP:
+            // Clicks act on what is under the cursor now, not at the last update.
+            if (moved)
+            {
+                widget_engine_refresh_hover();
+                moved = false;
+            }
+
+            break;
+        }
+
+        process_event();
+    }
+}
+
+// Signaled once the widget tweeners have been updated.
+// The tweeners are the frame's only pool work: predraw draws so stays on this thread and nothing updates particles yet.
+// Later stages that can run off this thread should chain on it with thread_pool_push_after and their own fence.
+static struct thread_pool_fence widget_fence;
+
 // Populate and run the thread pool. Doesn't wait for completion.
 static inline void update_work_queue()
 {
@@ -349,22 +633,27 @@ static inline void update_work_queue()
     delta_timestamp = future_timestamp - current_timestamp;
     
 	// Update tweeners
-    struct work_queue* queue = widget_engine_widget_work();
+    thread_pool_fence_init(&widget_fence);
+    widget_engine_widget_work(&widget_fence);
+    thread_pool_fence_seal(&widget_fence);
+
+    profiler_mark(PROFILER_UPDATE);
+}
+
+// Wait for the tweeners then update the widget engine, which reads and writes widget geometry.
+static inline void finish_work_queue()
+{
+    thread_pool_fence_wait(&widget_fence);
+    profiler_mark(PROFILER_WAIT);
 
-	thread_pool_concatenate(queue);
     widget_engine_update();
-    thread_pool_wait();
-	
+    profiler_mark(PROFILER_UPDATE);
+
     current_timestamp = future_timestamp;
 }
 
-// All the drawing that can be done before waiting for widget update to complete.
-static inline void predraw()
+static inline void clear_backbuffer()
 {
-    // The residual time can be used for projection in drawing
-    residual_timestamp = al_get_time() - future_timestamp;
-
-    // Process predraw then wait
     al_set_target_bitmap(al_get_backbuffer(display));
     al_set_blender(ALLEGRO_ADD, ALLEGRO_ONE, ALLEGRO_INVERSE_ALPHA);
     al_set_render_state(ALLEGRO_ALPHA_TEST, 1);
@@ -373,10 +662,147 @@ static inline void predraw()
     glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glEnable(GL_STENCIL_TEST);
     al_reset_clipping_rectangle();
+}
+
+// All the drawing that can be done before waiting for widget update to complete.
+// Only touches the camera and background so it overlaps with the tweeners.
+static inline void predraw()
+{
+    // The residual time can be used for projection in drawing
+    residual_timestamp = al_get_time() - future_timestamp;
+
+    // Process predraw then wait
+    clear_backbuffer();
 
     widget_interface_shader_predraw();
 
     background_draw();
+
+    profiler_mark(PROFILER_PREDRAW);
+}
+
+// Debug overlays drawn over the widgets.
+static inline void draw_overlays(double timestamp)
+{
+#ifdef EASY_BOARDER
+    al_use_transform(&identity_transform);
+    material_apply(NULL);
+    al_draw_rectangle(0, 0, 
+        al_get_display_width(display), al_get_display_height(display),
+        al_map_rgba(0,0,0,100), 10);
+#endif
+
+#ifdef EASY_FPS
+    al_use_transform(&identity_transform);
+    material_apply(NULL);
+    al_draw_textf(debug_font, al_map_rgb_f(0, 1, 0), 0, 0, 0, "FPS:%lf  Timestamp:%lf", 1.0 / (timestamp - last_render_timestamp), timestamp);
+    last_render_timestamp = timestamp;
+#endif
+
+    profiler_draw();
+}
+
+// Draws snapshots handed over by render_submit while the main thread simulates the next frame.
+// Picking is done here too since it needs the display, so hover lags input by a frame or two.
+static void* render_main(ALLEGRO_THREAD* thread, void* _)
+{
+    al_set_target_backbuffer(display);
+    trace_thread_name("render", -1);
+
+    al_set_render_state(ALLEGRO_ALPHA_FUNCTION, ALLEGRO_RENDER_NOT_EQUAL);
+    al_set_render_state(ALLEGRO_ALPHA_TEST_VALUE, 0);
+
+    while (true)
+    {
+        al_lock_mutex(render_mutex);
+
+        while (render_pending < 0 && !al_get_thread_should_stop(thread))
+            al_wait_cond(render_cond, render_mutex);
+
+        const int idx = render_pending;
+        render_pending = -1;
+
+        al_broadcast_cond(render_cond);
+        al_unlock_mutex(render_mutex);
+
+        if (idx < 0)
+            break;
+
+        TRACE_BEGIN(predraw_begin);
+
+        // Bitmaps loaded by lua on the main thread have no display, bring them over.
+        al_convert_memory_bitmaps();
+
+        clear_backbuffer();
+        widget_engine_snapshot_predraw(idx);
+        background_draw();
+
+        TRACE_END(predraw_begin, "predraw", NULL, NULL);
+        TRACE_BEGIN(draw_begin);
+
+        widget_engine_snapshot_draw(idx);
+        draw_overlays(al_get_time());
+
+        TRACE_END(draw_begin, "draw", NULL, NULL);
+        TRACE_BEGIN(flip_begin);
+
+        al_flip_display();
+
+        TRACE_END(flip_begin, "flip", NULL, NULL);
+        TRACE_BEGIN(pick_begin);
+
+        widget_engine_snapshot_pick(idx);
+
+        TRACE_END(pick_begin, "pick", NULL, NULL);
+    }
+
+    al_set_target_bitmap(NULL);
+
+    return NULL;
+}
+
+// Hand the display to the render thread, the main thread no longer draws.
+static void render_start()
+{
+    widget_engine_snapshot_picking();
+    al_set_target_bitmap(NULL);
+
+    render_thread = al_create_thread(render_main, NULL);
+    al_start_thread(render_thread);
+}
+
+static void render_stop()
+{
+    al_lock_mutex(render_mutex);
+    al_set_thread_should_stop(render_thread);
+    al_broadcast_cond(render_cond);
+    al_unlock_mutex(render_mutex);
+
+    al_join_thread(render_thread, NULL);
+    al_destroy_thread(render_thread);
+
+    al_set_target_backbuffer(display);
+}
+
+// Snapshot the frame for the render thread once it has taken the previous one.
+// That also means it has finished drawing the snapshot about to be overwritten.
+static void render_submit()
+{
+    al_lock_mutex(render_mutex);
+
+    while (render_pending >= 0)
+        al_wait_cond(render_cond, render_mutex);
+
+    al_unlock_mutex(render_mutex);
+
+    widget_engine_snapshot(render_back);
+
+    al_lock_mutex(render_mutex);
+    render_pending = render_back;
+    al_broadcast_cond(render_cond);
+    al_unlock_mutex(render_mutex);
+
+    render_back ^= 1;
 }
 
 void main()
@@ -387,15 +813,19 @@ void main()
 
     // Init the Allegro Environment
     allegro_init();
+    main_loop_init();
     thread_pool_init();
     global_init();
 
 	// Init Systems, check dependency graph for order.
 	resource_manager_init();
-    al_register_event_source(main_event_queue, scheduler_init());
+    al_register_event_source(main_event_queue, scheduler_init_from_config());
 
     // Miscellaneous Lua Interfaces
     lua_openL_misc(lua_state);
+    lua_openL_thread_pool(lua_state);
+    lua_openL_profiler(lua_state);
+    lua_openL_trace(lua_state);
     
     // Init Widgets
     widget_engine_init();
@@ -406,51 +836,132 @@ void main()
     // Resolve and Read Boot File
     lua_boot_file();
 
+    if (render_mutex)
+        render_start();
+
     // Main loop
     while (!do_exit)
     {
+        idle_wait();
+        profiler_skip();
+
         future_timestamp = al_get_time();
 
         if (future_timestamp - current_timestamp > 0.25)
             future_timestamp = current_timestamp + 0.25;
 
+        // With fixed steps simulate one step per pass until less than a step remains,
+        // drawing at least every quarter second of simulation so a slow machine slows down rather than stalls.
+        bool step = false;
+
+        if (step_timestamp > 0)
+        {
+            step = future_timestamp - current_timestamp >= step_timestamp && step_cnt < 0.25 / step_timestamp;
+            future_timestamp = step ? current_timestamp + step_timestamp : current_timestamp;
+        }
+
         scheduler_generate_events();
+        profiler_mark(PROFILER_SCHEDULER);
+
+        // In batch mode every timer due before the next event runs directly, sharing one widget update.
+        // When coalescing, events wait for the frame so timers aren't split around them.
+        double batch_timestamp = future_timestamp;
+
+        if (!coalesce_events && al_peek_next_event(main_event_queue, &current_event)
+            && current_event.any.timestamp < batch_timestamp)
+            batch_timestamp = current_event.any.timestamp;
+
+        if (scheduler_batch_collect(batch_timestamp))
+        {
+            future_timestamp = batch_timestamp;
+
+            update_work_queue();
+            finish_work_queue();
 
-        if (al_peek_next_event(main_event_queue, &current_event)
+            scheduler_batch_run();
+            profiler_mark(PROFILER_SCHEDULER);
+
+            // Passes that don't draw all count against the quarter second cap, not just steps.
+            step_cnt++;
+
+            continue;
+        }
+
+        if (coalesce_events)
+        {
+            drain_events();
+            profiler_mark(PROFILER_EVENTS);
+
+            if (step)
+            {
+                update_work_queue();
+                finish_work_queue();
+
+                step_cnt++;
+
+                continue;
+            }
+        }
+        else if (al_peek_next_event(main_event_queue, &current_event)
             && current_event.any.timestamp <= future_timestamp)
         {
             future_timestamp = current_event.any.timestamp;
 
             update_work_queue();
-            thread_pool_wait();
+            finish_work_queue();
 
             process_event();
             al_drop_next_event(main_event_queue);
+            profiler_mark(PROFILER_EVENTS);
+
+            step_cnt++;
 
             continue;
         }
 
-        update_work_queue();
-        predraw();
-        thread_pool_wait();
-        widget_engine_draw();
+        // Fixed steps have already simulated up to the frame, only drawing remains.
+        step_cnt = 0;
 
-#ifdef EASY_BOARDER
-        al_use_transform(&identity_transform);
-        material_apply(NULL);
-        al_draw_rectangle(0, 0, 
-            al_get_display_width(display), al_get_display_height(display),
-            al_map_rgba(0,0,0,100), 10);
-#endif
+        if (render_thread)
+        {
+            if (step_timestamp == 0)
+            {
+                update_work_queue();
+                finish_work_queue();
+            }
+
+            // The render thread draws this frame while the next is simulated.
+            render_submit();
+            profiler_mark(PROFILER_FLIP);
+        }
+        else
+        {
+            if (step_timestamp == 0)
+                update_work_queue();
 
-#ifdef EASY_FPS
-        al_use_transform(&identity_transform);
-        material_apply(NULL);
-        al_draw_textf(debug_font, al_map_rgb_f(0, 1, 0), 0, 0, 0, "FPS:%lf  Timestamp:%lf", 1.0 / (current_timestamp - last_render_timestamp), current_timestamp);
-        last_render_timestamp = current_timestamp;
-#endif
+            predraw();
 
-        // Flip
-        al_flip_display();
+            if (step_timestamp == 0)
+                finish_work_queue();
+
+            widget_engine_draw();
+            draw_overlays(current_timestamp);
+            profiler_mark(PROFILER_DRAW);
+
+            // Flip
+            al_flip_display();
+            profiler_mark(PROFILER_FLIP);
+        }
+
+        // All work from the frame has completed, reclaim its memory and refill the background budget.
+        thread_pool_frame_reset();
+        profiler_mark(PROFILER_WAIT);
+
+        profiler_frame_end();
     }
+
+    if (render_thread)
+        render_stop();
+
+    trace_close();
 }
\ No newline at end of file
@@ -75,6 +75,11 @@ static void mask(const struct wg_base* const wg)
 		al_map_rgb(0, 255, 0));
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	return wg_hit_rectangle(wg, x, y);
+}
+
 static int newindex(lua_State* L)
 {
 	struct material_test* const material_test = (struct material_test* const)check_widget_lua(-3, &material_test_jumptable);
@@ -125,6 +130,7 @@ const struct wg_jumptable_base material_test_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 
 	.newindex = newindex
 };
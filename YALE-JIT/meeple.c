@@ -44,6 +44,11 @@ static void mask(const struct wg_base* const wg)
 		0);
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	return wg_hit_bitmap(wg, resource_manager_icon(ICON_ID_MEEPLE), 512, 512, x, y);
+}
+
 static int index(lua_State* L)
 {
 	struct meeple* const meeple = (struct meeple* const)check_widget_lua(-2, &meeple_jumptable);
@@ -74,6 +79,7 @@ const struct wg_jumptable_piece meeple_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 	.index = index,
 };
 
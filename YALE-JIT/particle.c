@@ -9,6 +9,9 @@
 
 extern double current_timestamp;
 
+// Number of particles alive across every bin
+static size_t particle_live;
+
 struct particle
 {
 	struct particle_bin* bin;
@@ -36,6 +39,7 @@ static void particle_gc(struct particle* particle)
 				particle->gc(particle->data);
 
 			bin->particles[i--] = bin->particles[--bin->particles_used];
+			particle_live--;
 
 			break;
 		}
@@ -67,6 +71,8 @@ void particle_bin_del(struct particle_bin* bin)
 		if (bin->particles[i].gc)
 			bin->particles[i].gc(bin->particles[i].data);
 
+	particle_live -= bin->particles_used;
+
 	free(bin->particles);
 	free(bin);
 }
@@ -87,6 +93,7 @@ void particle_bin_append(struct particle_bin* bin, void (*callback)(void*, doubl
 	}
 
 	struct particle* const particle = bin->particles + bin->particles_used++;
+	particle_live++;
 
 	*particle = (struct particle)
 	{
@@ -100,6 +107,11 @@ void particle_bin_append(struct particle_bin* bin, void (*callback)(void*, doubl
 	scheduler_push(lifespan, particle_gc, particle);
 }
 
+size_t particle_live_cnt()
+{
+	return particle_live;
+}
+
 void particle_bin_callback(struct particle_bin* bin)
 {
 	for (size_t i = 0; i < bin->particles_used; i++)
@@ -3,8 +3,11 @@
 // license that can be found in the LICENSE file.
 #pragma once
 
+#include <stddef.h>
+
 struct particle_bin* particle_bin_new(size_t);
 void particle_bin_del(struct particle_bin*);
 
 void particle_bin_append(struct particle_bin*, void (*)(void*, double), void (*)(void*), void*, double);
-void particle_bin_callback(struct particle_bin*);
\ No newline at end of file
+void particle_bin_callback(struct particle_bin*);
+size_t particle_live_cnt();
\ No newline at end of file
@@ -0,0 +1,226 @@
+// Copyright 2024 Kieran W Harvie. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+
+#include "profiler.h"
+#include "trace.h"
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_primitives.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+extern ALLEGRO_FONT* debug_font;
+extern const ALLEGRO_TRANSFORM identity_transform;
+
+struct profiler_frame
+{
+	double timestamp;
+	double phase[PROFILER_PHASE_CNT];
+};
+
+// Ring of the last frames_allocated frames, frame_cnt is the frame being recorded.
+// The overlay may be drawn by the render thread so the count is published once a frame is complete.
+static struct profiler_frame* frames;
+static size_t frames_allocated;
+static atomic_size_t frame_cnt;
+
+static double last_mark;
+static bool overlay;
+
+static const char* const phase_name[PROFILER_PHASE_CNT] = {
+	"scheduler",
+	"events",
+	"update",
+	"predraw",
+	"wait",
+	"draw",
+	"flip"
+};
+
+static const float phase_color[PROFILER_PHASE_CNT][3] = {
+	{ 0.9, 0.6, 0.1 },
+	{ 0.9, 0.2, 0.6 },
+	{ 0.2, 0.5, 0.9 },
+	{ 0.5, 0.5, 0.5 },
+	{ 0.9, 0.1, 0.1 },
+	{ 0.2, 0.8, 0.3 },
+	{ 0.6, 0.3, 0.9 }
+};
+
+// Overlay scale and placement
+#define PROFILER_PIXELS_PER_MS 4.0
+#define PROFILER_BAR_WIDTH 2.0
+#define PROFILER_MARGIN 10.0
+
+static struct profiler_frame* profiler_current()
+{
+	return frames + atomic_load_explicit(&frame_cnt, memory_order_relaxed) % frames_allocated;
+}
+
+// Dump the recorded frames from oldest to newest as csv, in milliseconds.
+bool profiler_dump(const char* file_name)
+{
+	if (!frames)
+		return false;
+
+	FILE* file;
+
+	if (fopen_s(&file, file_name, "w") != 0 || !file)
+		return false;
+
+	fprintf(file, "frame,timestamp");
+
+	for (size_t i = 0; i < PROFILER_PHASE_CNT; i++)
+		fprintf(file, ",%s", phase_name[i]);
+
+	fprintf(file, ",total\n");
+
+	// The slot after the newest frame is already being recorded into.
+	const size_t end = atomic_load_explicit(&frame_cnt, memory_order_acquire);
+	const size_t begin = end + 1 > frames_allocated ? end + 1 - frames_allocated : 0;
+
+	for (size_t frame = begin; frame < end; frame++)
+	{
+		const struct profiler_frame* const record = frames + frame % frames_allocated;
+		double total = 0;
+
+		fprintf(file, "%zu,%f", frame, record->timestamp);
+
+		for (size_t i = 0; i < PROFILER_PHASE_CNT; i++)
+		{
+			fprintf(file, ",%f", 1000 * record->phase[i]);
+			total += record->phase[i];
+		}
+
+		fprintf(file, ",%f\n", 1000 * total);
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+// Lua: profiler_dump([file_name]) returns whether the file was written.
+static int lua_profiler_dump(lua_State* L)
+{
+	lua_pushboolean(L, profiler_dump(luaL_optstring(L, 1, "profile.csv")));
+
+	return 1;
+}
+
+void lua_openL_profiler(lua_State* L)
+{
+	lua_pushcfunction(L, lua_profiler_dump);
+	lua_setglobal(L, "profiler_dump");
+}
+
+// Keep history of the given number of frames, 0 disables the profiler.
+void profiler_init(size_t history)
+{
+	if (history < 2)
+		return;
+
+	frames = calloc(history, sizeof(struct profiler_frame));
+
+	if (!frames)
+		return;
+
+	frames_allocated = history;
+	last_mark = al_get_time();
+}
+
+// Don't charge the time since the last mark to any phase, e.g. sleeping in idle mode.
+void profiler_skip()
+{
+	if (!frames && !trace_enabled)
+		return;
+
+	last_mark = al_get_time();
+}
+
+// Charge the time since the last mark to the given phase, and trace it as a span when tracing.
+void profiler_mark(enum profiler_phase phase)
+{
+	if (!frames && !trace_enabled)
+		return;
+
+	TRACE_END(last_mark, phase_name[phase], NULL, NULL);
+
+	const double now = al_get_time();
+
+	if (frames)
+		profiler_current()->phase[phase] += now - last_mark;
+
+	last_mark = now;
+}
+
+void profiler_frame_end()
+{
+	if (!frames)
+		return;
+
+	profiler_current()->timestamp = last_mark;
+
+	const size_t next = atomic_load_explicit(&frame_cnt, memory_order_relaxed) + 1;
+	struct profiler_frame* const record = frames + next % frames_allocated;
+
+	for (size_t i = 0; i < PROFILER_PHASE_CNT; i++)
+		record->phase[i] = 0;
+
+	atomic_store_explicit(&frame_cnt, next, memory_order_release);
+}
+
+void profiler_toggle_overlay()
+{
+	overlay = !overlay;
+}
+
+// Stacked bar per frame along the bottom left, newest on the right, with a line at 60 fps.
+void profiler_draw()
+{
+	if (!frames || !overlay)
+		return;
+
+	al_use_shader(NULL);
+	al_use_transform(&identity_transform);
+
+	const double bottom = al_get_display_height(al_get_current_display()) - PROFILER_MARGIN;
+
+	// The slot after the newest frame is already being recorded into.
+	const size_t end = atomic_load_explicit(&frame_cnt, memory_order_acquire);
+	const size_t begin = end + 1 > frames_allocated ? end + 1 - frames_allocated : 0;
+
+	for (size_t frame = begin; frame < end; frame++)
+	{
+		const struct profiler_frame* const record = frames + frame % frames_allocated;
+		const double x = PROFILER_MARGIN + PROFILER_BAR_WIDTH * (frame - begin);
+		double y = bottom;
+
+		for (size_t i = 0; i < PROFILER_PHASE_CNT; i++)
+		{
+			const double height = 1000 * PROFILER_PIXELS_PER_MS * record->phase[i];
+
+			al_draw_filled_rectangle(x, y - height, x + PROFILER_BAR_WIDTH, y,
+				al_map_rgb_f(phase_color[i][0], phase_color[i][1], phase_color[i][2]));
+
+			y -= height;
+		}
+	}
+
+	const double budget = bottom - 1000 * PROFILER_PIXELS_PER_MS / 60.0;
+
+	al_draw_line(PROFILER_MARGIN, budget, PROFILER_MARGIN + PROFILER_BAR_WIDTH * frames_allocated, budget,
+		al_map_rgb_f(1, 1, 1), 1);
+
+	for (size_t i = 0; i < PROFILER_PHASE_CNT; i++)
+		al_draw_text(debug_font, al_map_rgb_f(phase_color[i][0], phase_color[i][1], phase_color[i][2]),
+			PROFILER_MARGIN + PROFILER_BAR_WIDTH * frames_allocated + PROFILER_MARGIN,
+			bottom - 10.0 * (PROFILER_PHASE_CNT - i), 0, phase_name[i]);
+}
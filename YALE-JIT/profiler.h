@@ -0,0 +1,29 @@
+// Copyright 2024 Kieran W Harvie. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#pragma once
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Phases of the main loop, a frame is every pass of the loop up to and including a flip.
+enum profiler_phase
+{
+	PROFILER_SCHEDULER,		// Generating timer events and running batched timers
+	PROFILER_EVENTS,		// Processing input and timer events
+	PROFILER_UPDATE,		// Queuing the tweeners and the widget engine update
+	PROFILER_PREDRAW,		// Clearing and drawing the background
+	PROFILER_WAIT,			// Waiting on the thread pool
+	PROFILER_DRAW,			// Drawing widgets and overlays
+	PROFILER_FLIP,			// Flipping the display, or handing off to the render thread
+	PROFILER_PHASE_CNT
+};
+
+void profiler_init(size_t);
+void profiler_skip();
+void profiler_mark(enum profiler_phase);
+void profiler_frame_end();
+
+void profiler_toggle_overlay();
+void profiler_draw();
+bool profiler_dump(const char*);
@@ -3,10 +3,15 @@
 // license that can be found in the LICENSE file.
 
 // #define SCHEDULER_TESTING
+// #define SCHEDULER_BENCHMARK
 
 #include "scheduler.h"
+#include "trace.h"
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
 
 #include "allegro5/allegro.h"
 
@@ -21,17 +26,87 @@ void stack_dump(lua_State*);
 
 void stack_dump(lua_State*);
 
+// Scheduler nodes are handed out as handles so they can't move,
+// they are carved out of pooled chunks and recycled through a free list instead of malloced one at a time.
+// Each node knows where it's stored, its heap index or wheel slot, so removing or rescheduling it doesn't have to search.
+
+#define SCHEDULER_CHUNK_SIZE 256
+#define SCHEDULER_NO_INDEX ((size_t)-1)
+
 struct scheduler_interface
 {
-	double timestamp;
+	double timestamp;					// When the node fires, its due time rounded up to its slack
 	void (*funct)(void*);
 	void* data;
+
+	double due;							// When the node was asked to fire
+	double interval;					// Period of a repeating node, 0 for a one shot
+	double slack;						// How late the node may fire so it can share a wake up, 0 for none
+
+	size_t index;						// Heap index or wheel slot, SCHEDULER_NO_INDEX when not scheduled
+	struct scheduler_interface* next;	// Next node in the wheel slot, or next free node
+	struct scheduler_interface* prev;	// Previous node in the wheel slot
+};
+
+// The timers are kept by one of two interchangable backends, chosen at init.
+struct scheduler_backend
+{
+	bool (*insert)(struct scheduler_interface*);
+	void (*remove)(struct scheduler_interface*);
+	bool (*contains)(const struct scheduler_interface*);
+	void (*update)(struct scheduler_interface*);	// The node's timestamp has changed
+	void (*expire)(double, void (*)(struct scheduler_interface*));	// Fire every node due by the time
+	double (*next)();	// No node fires before this time
+};
+
+struct scheduler_chunk
+{
+	struct scheduler_chunk* next;
+	struct scheduler_interface nodes[SCHEDULER_CHUNK_SIZE];
 };
 
 static struct scheduler_interface** heap;
 static size_t allocated;
 static size_t used;
 
+static struct scheduler_chunk* chunks;
+static struct scheduler_interface* free_nodes;
+
+static const struct scheduler_backend* backend;
+
+// Timers taken out of the backend in batch mode, run directly rather than through the event queue
+struct scheduler_batch_item
+{
+	double timestamp;
+	void (*funct)(void*);
+	void* data;
+};
+
+static double expire_time;		// Time the backend is currently expiring up to
+
+// Timers pushed from other threads wait in a bounded lock-free MPSC ring until the main thread merges them.
+// Each cell's sequence says whose turn it is: equal to a producer's position when free, one past it once filled.
+#define STAGING_SIZE 4096
+
+struct staging_cell
+{
+	atomic_size_t sequence;
+	double delay;
+	void (*funct)(void*);
+	void* data;
+};
+
+static struct staging_cell staging[STAGING_SIZE];
+static atomic_size_t staging_tail;	// Next position producers claim
+static size_t staging_head;			// Next position the main thread merges
+static atomic_bool staging_wake;	// The main thread is waiting, the next push should wake it
+static _Thread_local bool main_thread;	// Set on the thread that called scheduler_init, the only one the backend is touched from
+
+static bool batch_mode;
+static struct scheduler_batch_item* batch;
+static size_t batch_allocated;
+static size_t batch_used;
+
 static ALLEGRO_EVENT_SOURCE scheduler_event_source;
 
 extern double current_timestamp;
@@ -60,6 +135,9 @@ static inline void heap_swap(size_t i, size_t j)
 	tmp = heap[i];
 	heap[i] = heap[j];
 	heap[j] = tmp;
+
+	heap[i]->index = i;
+	heap[j]->index = j;
 }
 
 // The node has potentially decreased, maintain the heap property by moving it up
@@ -123,64 +201,298 @@ static inline void heap_heapify(size_t node)
 }
 
 // Insert an item into the heap
-static inline void heap_insert(struct scheduler_interface* item)
+static inline bool heap_insert(struct scheduler_interface* item)
 {
+	if (allocated <= used)
+	{
+		const size_t new_cnt = 2 * allocated + 1;
+
+		struct scheduler_interface** memsafe_hande = realloc(heap, new_cnt * sizeof(struct scheduler_interface*));
+
+		if (!memsafe_hande)
+			return false;
+
+		heap = memsafe_hande;
+		allocated = new_cnt;
+	}
+
+	item->index = used;
 	heap[used++] = item;
 
 	heap_heapify_up(used - 1);
+
+	return true;
 }
 
 // Remove and item from the heap, it will be located at heap[used]
 static inline void heap_remove(size_t node)
 {
 	heap_swap(node, --used);
+	heap[used]->index = SCHEDULER_NO_INDEX;
 
 	// TODO: We could check the timestamp change here and call heap_heapify_{left,right} directly.
 	// Saving comparison in heap_heapify.
-	heap_heapify(node);
+	if (node < used)
+		heap_heapify(node);
 }
 
 // Remove the minimum item from the heap, it will be located at heap[used]
 static inline void heap_pop()
 {
-	if (used <= 1)
+	heap_remove(0);
+}
+
+// Is the item currently in the heap
+static bool heap_contains(const struct scheduler_interface* item)
+{
+	return item && item->index < used && heap[item->index] == item;
+}
+
+static bool heap_backend_insert(struct scheduler_interface* item)
+{
+	return heap_insert(item);
+}
+
+static void heap_backend_remove(struct scheduler_interface* item)
+{
+	heap_remove(item->index);
+}
+
+static void heap_backend_update(struct scheduler_interface* item)
+{
+	heap_heapify(item->index);
+}
+
+static double heap_backend_next()
+{
+	return used ? heap[0]->timestamp : INFINITY;
+}
+
+// Fire the items in timestamp order
+static void heap_backend_expire(double time, void (*fire)(struct scheduler_interface*))
+{
+	while (used && heap[0]->timestamp < time)
 	{
-		used--;
+		struct scheduler_interface* const item = heap[0];
+
+		heap_pop();
+		fire(item);
+	}
+}
+
+static const struct scheduler_backend heap_backend =
+{
+	.insert = heap_backend_insert,
+	.remove = heap_backend_remove,
+	.contains = heap_contains,
+	.update = heap_backend_update,
+	.expire = heap_backend_expire,
+	.next = heap_backend_next
+};
+
+// Timing Wheel Operations
+
+// Time is cut into ticks of a fixed resolution and an item is due on the first tick at or after its timestamp.
+// Each level of the wheel covers one base WHEEL_SLOTS digit of the tick, an item goes in the level of the
+// highest digit where its tick differs from the current tick, in the slot of that digit.
+// When the lower digits of the current tick roll over, the slot for the new digit is cascaded down a level.
+// Insert, remove and the per item cost of expiry are O(1), but items due on the same tick fire in no particular order.
+
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define WHEEL_OVERFLOW (WHEEL_LEVELS * WHEEL_SLOTS)	// Slot for items past the top level
+
+static struct scheduler_interface* wheel[WHEEL_LEVELS * WHEEL_SLOTS + 1];
+static double wheel_resolution;
+static int64_t wheel_tick;		// The last tick that has been expired
+static size_t wheel_cnt[WHEEL_LEVELS + 1];	// Number of items in each level, the overflow last
+
+static inline int64_t wheel_tick_of(double timestamp)
+{
+	return (int64_t)ceil(timestamp / wheel_resolution);
+}
+
+static inline void wheel_link(struct scheduler_interface* item, size_t slot)
+{
+	item->index = slot;
+	item->prev = NULL;
+	item->next = wheel[slot];
+
+	if (wheel[slot])
+		wheel[slot]->prev = item;
+
+	wheel[slot] = item;
+	wheel_cnt[slot / WHEEL_SLOTS]++;
+}
+
+static inline void wheel_unlink(struct scheduler_interface* item)
+{
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		wheel[item->index] = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+
+	wheel_cnt[item->index / WHEEL_SLOTS]--;
+	item->index = SCHEDULER_NO_INDEX;
+}
+
+// Place an item due on tick, which must not be before the current tick
+static void wheel_place(struct scheduler_interface* item, int64_t tick)
+{
+	const uint64_t diff = (uint64_t)(tick ^ wheel_tick);
+	size_t level = 0;
+
+	while (level < WHEEL_LEVELS && diff >> (WHEEL_BITS * (level + 1)))
+		level++;
+
+	if (level == WHEEL_LEVELS)
+	{
+		wheel_link(item, WHEEL_OVERFLOW);
 		return;
 	}
 
-	heap_swap(0, --used);
+	wheel_link(item, level * WHEEL_SLOTS + ((tick >> (WHEEL_BITS * level)) & (WHEEL_SLOTS - 1)));
+}
+
+// Take every item out of a slot and place it again against the current tick.
+// Called while the current tick is being expired, items inserted late were clamped past their own tick
+// so clamp them again to land on this one rather than a slot behind the wheel.
+static void wheel_cascade(size_t slot)
+{
+	struct scheduler_interface* item = wheel[slot];
+
+	while (item)
+	{
+		struct scheduler_interface* const next = item->next;
+		const int64_t tick = wheel_tick_of(item->timestamp);
+
+		wheel_unlink(item);
+		wheel_place(item, tick < wheel_tick ? wheel_tick : tick);
 
-	heap_heapify_down(0);
+		item = next;
+	}
 }
 
-// Find and item in the heap
-static size_t heap_find(size_t node, struct scheduler_interface* item)
+static bool wheel_backend_insert(struct scheduler_interface* item)
 {
-	if (item == heap[node])
-		return node;
+	int64_t tick = wheel_tick_of(item->timestamp);
 
-	if (item->timestamp < heap[node]->timestamp)
-		return 0;
+	// The current tick has already been expired
+	if (tick <= wheel_tick)
+		tick = wheel_tick + 1;
 
-	size_t child_left, child_right;
+	wheel_place(item, tick);
 
-	heap_children(node, &child_left, &child_right);
+	return true;
+}
 
-	if (child_right >= used)
-		return 0;
+static void wheel_backend_remove(struct scheduler_interface* item)
+{
+	wheel_unlink(item);
+}
+
+static bool wheel_backend_contains(const struct scheduler_interface* item)
+{
+	return item && item->index <= WHEEL_OVERFLOW;
+}
 
-	if (child_left == used - 1)
-		return heap[child_left] == item ? child_left : 0;
+static void wheel_backend_update(struct scheduler_interface* item)
+{
+	wheel_unlink(item);
+	wheel_backend_insert(item);
+}
 
-	const size_t idx = heap_find(child_left, item);
+// Fire the items tick by tick
+static void wheel_backend_expire(double time, void (*fire)(struct scheduler_interface*))
+{
+	const int64_t target = (int64_t)floor(time / wheel_resolution);
 
-	if (idx)
-		return idx;
+	while (wheel_tick < target)
+	{
+		// Nothing can fire before the lowest occupied level next cascades, skip to the tick before it
+		size_t lowest = 0;
 
-	return heap_find(child_right, item);
+		while (lowest <= WHEEL_LEVELS && wheel_cnt[lowest] == 0)
+			lowest++;
+
+		if (lowest > WHEEL_LEVELS)
+		{
+			wheel_tick = target;
+			return;
+		}
+
+		if (lowest > 0)
+		{
+			const int64_t skip = wheel_tick | (((int64_t)1 << (WHEEL_BITS * lowest)) - 1);
+
+			if (skip >= target)
+			{
+				wheel_tick = target;
+				return;
+			}
+
+			wheel_tick = skip;
+		}
+
+		wheel_tick++;
+
+		// Cascade from the highest level whose lower digits rolled over, so its items can land in the slots below
+		size_t level = 0;
+
+		while (level < WHEEL_LEVELS && (wheel_tick & (((int64_t)1 << (WHEEL_BITS * (level + 1))) - 1)) == 0)
+			level++;
+
+		if (level == WHEEL_LEVELS)
+			wheel_cascade(WHEEL_OVERFLOW);
+
+		for (size_t i = level < WHEEL_LEVELS ? level : WHEEL_LEVELS - 1; i > 0; i--)
+			wheel_cascade(i * WHEEL_SLOTS + ((wheel_tick >> (WHEEL_BITS * i)) & (WHEEL_SLOTS - 1)));
+
+		const size_t slot = wheel_tick & (WHEEL_SLOTS - 1);
+
+		while (wheel[slot])
+		{
+			struct scheduler_interface* const item = wheel[slot];
+
+			wheel_unlink(item);
+			fire(item);
+		}
+	}
 }
 
+// Exact while the bottom level has items, otherwise the next cascade of the lowest occupied level
+static double wheel_backend_next()
+{
+	size_t lowest = 0;
+
+	while (lowest <= WHEEL_LEVELS && wheel_cnt[lowest] == 0)
+		lowest++;
+
+	if (lowest > WHEEL_LEVELS)
+		return INFINITY;
+
+	if (lowest > 0)
+		return ((wheel_tick | (((int64_t)1 << (WHEEL_BITS * lowest)) - 1)) + 1) * wheel_resolution;
+
+	for (int64_t tick = wheel_tick + 1; ; tick++)
+		if (wheel[tick & (WHEEL_SLOTS - 1)])
+			return tick * wheel_resolution;
+}
+
+static const struct scheduler_backend wheel_backend =
+{
+	.insert = wheel_backend_insert,
+	.remove = wheel_backend_remove,
+	.contains = wheel_backend_contains,
+	.update = wheel_backend_update,
+	.expire = wheel_backend_expire,
+	.next = wheel_backend_next
+};
+
 #ifdef SCHEDULER_TESTING
 static void scheduler_dump()
 {
@@ -196,53 +508,79 @@ static void scheduler_dump()
 
 struct scheduler_item_lua
 {
-	struct scheduler_interface* scheduler_interface;
+	struct scheduler_interface* scheduler_interface;	// NULL once fired or removed
 };
 
+// Get the node of a lua item if it's still scheduled.
+// Nodes are recycled once fired, so also check the node still belongs to the item.
+static struct scheduler_interface* scheduler_item_node(const struct scheduler_item_lua* item)
+{
+	struct scheduler_interface* const node = item->scheduler_interface;
+
+	if (!backend->contains(node) || node->data != item)
+		return NULL;
+
+	return node;
+}
+
 static void scheduler_call_wapper(void* data)
 {
-	const struct scheduler_item_lua* item = (struct scheduler_item_lua*)data;
+	struct scheduler_item_lua* item = (struct scheduler_item_lua*)data;
 
 	lua_getglobal(lua_state, "scheduler");
 	lua_pushlightuserdata(lua_state, item);
 	lua_gettable(lua_state, -2);
-	
+
+	// Removed after it fired but before it was dispatched, the item may already be collected
+	if (lua_isnil(lua_state, -1))
+	{
+		lua_pop(lua_state, 2);
+		return;
+	}
+
 	lua_getfenv(lua_state, -1);
 	lua_getfield(lua_state, -1, "callback");
 
+	TRACE_BEGIN(trace_begin);
 	lua_call(lua_state, 0, 0);
+	TRACE_END(trace_begin, "timer", NULL, item);
 
-	lua_pushlightuserdata(lua_state, item);
-	lua_pushnil(lua_state);
-	lua_settable(lua_state, -5);
+	// Repeating items stay scheduled until removed
+	if (!scheduler_item_node(item))
+	{
+		item->scheduler_interface = NULL;
+
+		lua_pushlightuserdata(lua_state, item);
+		lua_pushnil(lua_state);
+		lua_settable(lua_state, -5);
+	}
 
 	lua_pop(lua_state, 3);
 }
 
+// Lua: push(delay, callback [, interval [, slack]])
+// With an interval the callback repeats every interval seconds until the item is removed.
+// With slack the callback may run up to slack seconds late so it can share a wake up with other timers.
 static int scheduler_push_lua(lua_State* L)
 {
-	const double timestamp = luaL_checknumber(L, -2);
+	const double timestamp = luaL_checknumber(L, 1);
+	const double interval = luaL_optnumber(L, 3, 0);
+	const double slack = luaL_optnumber(L, 4, 0);
 
-	if (!lua_isfunction(L, -1))
-	{
-		lua_pop(L, 1);
+	if (!lua_isfunction(L, 2))
 		return 0;
-	}
 
 	struct scheduler_item_lua* item = lua_newuserdata(L, sizeof(struct scheduler_item_lua));
 
 	if (!item)
-	{
-		lua_pop(L, 2);
 		return 0;
-	}
 
 	lua_createtable(L, 1, 0);
-	lua_pushvalue(L, -3);
+	lua_pushvalue(L, 2);
 	lua_setfield(L, -2, "callback");
 	lua_setfenv(L, -2);
 
-	item->scheduler_interface = scheduler_push(timestamp, scheduler_call_wapper, item);
+	item->scheduler_interface = scheduler_push_periodic(timestamp, interval, slack, scheduler_call_wapper, item);
 
 	// Set metatable
 	luaL_getmetatable(L, "scheule_item_mt");
@@ -254,8 +592,6 @@ static int scheduler_push_lua(lua_State* L)
 	lua_pushvalue(L, -3);
 	lua_settable(L, -3);
 
-	lua_pop(L, 1);
-	lua_replace(L, -3);
 	lua_pop(L, 1);
 
 	return 1;
@@ -263,8 +599,9 @@ static int scheduler_push_lua(lua_State* L)
 
 static int scheduler_remove_lua(lua_State* L)
 {
-	const struct scheduler_item_lua* item = (struct scheduler_item_lua*)luaL_checkudata(L, -1, "scheule_item_mt");
-	scheduler_pop(item->scheduler_interface);
+	struct scheduler_item_lua* item = (struct scheduler_item_lua*)luaL_checkudata(L, -1, "scheule_item_mt");
+	scheduler_pop(scheduler_item_node(item));
+	item->scheduler_interface = NULL;
 
 	lua_getglobal(L, "scheduler");
 	lua_pushlightuserdata(L, item);
@@ -281,7 +618,7 @@ static int scheduler_change_lua(lua_State* L)
 	struct scheduler_item_lua* item = (struct scheduler_item_lua*)luaL_checkudata(L, -2, "scheule_item_mt");
 	const double time = luaL_checknumber(L, -1);
 
-	scheduler_change_timestamp(item->scheduler_interface, time, 0);
+	scheduler_change_timestamp(scheduler_item_node(item), time, 0);
 
 	lua_pop(L, 2);
 
@@ -291,22 +628,225 @@ static int scheduler_change_lua(lua_State* L)
 
 // Private Scheduler Interface
 
-// Free a schedyler node, doesn't maintain heap property
-static inline void scheduler_free_node(size_t node)
+// Get a node from the pool, adding a chunk if it's empty
+static struct scheduler_interface* scheduler_alloc_node()
+{
+	if (!free_nodes)
+	{
+		struct scheduler_chunk* const chunk = malloc(sizeof(struct scheduler_chunk));
+
+		if (!chunk)
+			return NULL;
+
+		chunk->next = chunks;
+		chunks = chunk;
+
+		for (size_t i = 0; i < SCHEDULER_CHUNK_SIZE; i++)
+		{
+			chunk->nodes[i].index = SCHEDULER_NO_INDEX;
+			chunk->nodes[i].next = free_nodes;
+			free_nodes = chunk->nodes + i;
+		}
+	}
+
+	struct scheduler_interface* const node = free_nodes;
+	free_nodes = node->next;
+
+	return node;
+}
+
+// Return a node to the pool, it must already be out of the heap
+static inline void scheduler_free_node(struct scheduler_interface* node)
 {
-	free(heap[node]);
-	heap[node] = NULL;
+	node->next = free_nodes;
+	free_nodes = node;
 }
 
-#ifdef SCHEDULER_TESTING
+// When a node due at the time fires given its slack
+static inline double scheduler_deadline(double due, double slack)
+{
+	// Rounding up to a grid of the slack makes nodes with the same slack due close together fire together
+	return slack > 0 ? slack * ceil(due / slack) : due;
+}
+
+// A node has fired, recycle it or if it repeats schedule its next period after the expiry time
+// Missed periods are skipped rather than fired late.
+static void scheduler_retire(struct scheduler_interface* item)
+{
+	if (item->interval <= 0)
+	{
+		scheduler_free_node(item);
+		return;
+	}
+
+	item->due += item->interval;
+
+	if (item->due < expire_time)
+		item->due += item->interval * ceil((expire_time - item->due) / item->interval);
+
+	item->timestamp = scheduler_deadline(item->due, item->slack);
+
+	// Guard against rounding leaving it due now, which would fire it again in the same expiry
+	if (item->timestamp < expire_time)
+		item->timestamp = expire_time;
+
+	if (!backend->insert(item))
+		scheduler_free_node(item);
+}
+
+// Push the timers staged by other threads, only called by the main thread
+static void scheduler_merge_staging()
+{
+	while (1)
+	{
+		struct staging_cell* const cell = staging + (staging_head & (STAGING_SIZE - 1));
+
+		if (atomic_load_explicit(&cell->sequence, memory_order_acquire) != staging_head + 1)
+			return;
+
+		scheduler_push_periodic(cell->delay, 0, 0, cell->funct, cell->data);
+
+		// Hand the cell back to the producers for the next lap
+		atomic_store_explicit(&cell->sequence, staging_head + STAGING_SIZE, memory_order_release);
+		staging_head++;
+	}
+}
+
+// Emit the event for a due node and retire it
+static void scheduler_fire(struct scheduler_interface* item)
+{
+	ALLEGRO_EVENT ev;
+	ev.type = ALLEGRO_GET_EVENT_TYPE('T', 'I', 'M', 'E');
+	ev.user.data1 = (intptr_t)item->funct;
+	ev.user.data2 = (intptr_t)item->data;
+
+	al_emit_user_event(&scheduler_event_source, &ev, NULL);
+
+	scheduler_retire(item);
+}
+
+// Add a due node to the batch and retire it, falls back to an event if the batch can't grow
+static void scheduler_batch_add(struct scheduler_interface* item)
+{
+	if (batch_allocated <= batch_used)
+	{
+		const size_t new_cnt = 2 * batch_allocated + 1;
+
+		struct scheduler_batch_item* memsafe_hande = realloc(batch, new_cnt * sizeof(struct scheduler_batch_item));
+
+		if (!memsafe_hande)
+		{
+			scheduler_fire(item);
+			return;
+		}
+
+		batch = memsafe_hande;
+		batch_allocated = new_cnt;
+	}
+
+	batch[batch_used++] = (struct scheduler_batch_item)
+	{
+		.timestamp = item->timestamp,
+		.funct = item->funct,
+		.data = item->data
+	};
+
+	scheduler_retire(item);
+}
+
+static int scheduler_batch_compare(const void* a, const void* b)
+{
+	const double lhs = ((const struct scheduler_batch_item*)a)->timestamp;
+	const double rhs = ((const struct scheduler_batch_item*)b)->timestamp;
+
+	return (lhs > rhs) - (lhs < rhs);
+}
+
+#if defined(SCHEDULER_TESTING) || defined(SCHEDULER_BENCHMARK)
 static void test(void* _)
 {
 	printf("%lf\n", current_timestamp);
 }
 #endif
 
+#ifdef SCHEDULER_BENCHMARK
+static size_t benchmark_fired;
+
+static void benchmark_fire(struct scheduler_interface* item)
+{
+	benchmark_fired++;
+	scheduler_free_node(item);
+}
+
+// Time insert, cancel and reschedule, and expiry of both backends with 1k, 100k and 1M live timers spread over 10 seconds
+static void scheduler_benchmark()
+{
+	static const size_t sizes[] = { 1000, 100000, 1000000 };
+	static const struct scheduler_backend* const backends[] = { &heap_backend, &wheel_backend };
+	static const char* const names[] = { "heap", "wheel" };
+
+	const struct scheduler_backend* const saved_backend = backend;
+	const double saved_timestamp = current_timestamp;
+	double base = current_timestamp;
+
+	for (size_t b = 0; b < 2; b++)
+		for (size_t s = 0; s < 3; s++)
+		{
+			const size_t cnt = sizes[s];
+			const size_t churn = cnt < 100000 ? cnt : 100000;
+			struct scheduler_interface** handles = malloc(cnt * sizeof(struct scheduler_interface*));
+
+			if (!handles)
+				continue;
+
+			// Start each run from a clean clock
+			base += 100;
+			current_timestamp = base;
+			wheel_tick = (int64_t)floor(base / wheel_resolution);
+			backend = backends[b];
+			srand(1);
+
+			double start = al_get_time();
+
+			for (size_t i = 0; i < cnt; i++)
+				handles[i] = scheduler_push(10.0 * rand() / RAND_MAX, test, NULL);
+
+			const double insert_time = al_get_time() - start;
+
+			start = al_get_time();
+
+			for (size_t i = 0; i < churn; i++)
+			{
+				const size_t j = ((size_t)rand() * RAND_MAX + rand()) % cnt;
+
+				scheduler_pop(handles[j]);
+				handles[j] = scheduler_push(10.0 * rand() / RAND_MAX, test, NULL);
+				scheduler_change_timestamp(handles[(j + 1) % cnt], 0.001, 0);
+			}
+
+			const double churn_time = al_get_time() - start;
+
+			benchmark_fired = 0;
+			start = al_get_time();
+
+			backend->expire(base + 11, benchmark_fire);
+
+			const double expire_seconds = al_get_time() - start;
+
+			printf("Scheduler benchmark %s %zu: insert %.1lfns, cancel+push+change %.1lfns, expire %.1lfns (%zu fired)\n",
+				names[b], cnt, 1e9 * insert_time / cnt, 1e9 * churn_time / churn, 1e9 * expire_seconds / cnt, benchmark_fired);
+
+			free(handles);
+		}
+
+	backend = saved_backend;
+	current_timestamp = saved_timestamp;
+	wheel_tick = (int64_t)floor(al_current_time() / wheel_resolution);
+}
+#endif
+
 // Initalize the scheduler
-ALLEGRO_EVENT_SOURCE* scheduler_init()
+ALLEGRO_EVENT_SOURCE* scheduler_init(const struct scheduler_config* config)
 {
 	heap = malloc(sizeof(struct scheduler_interface*));
 
@@ -316,11 +856,22 @@ ALLEGRO_EVENT_SOURCE* scheduler_init()
 		return NULL;
 	}
 
-	heap[0] = NULL;
-
 	allocated = 1;
 	used = 0;
 
+	backend = config->backend == SCHEDULER_WHEEL ? &wheel_backend : &heap_backend;
+	batch_mode = config->batch;
+
+	for (size_t i = 0; i < STAGING_SIZE; i++)
+		atomic_init(&staging[i].sequence, i);
+
+	atomic_init(&staging_tail, 0);
+	atomic_init(&staging_wake, false);
+	staging_head = 0;
+	main_thread = true;
+	wheel_resolution = config->resolution > 0 ? config->resolution : 0.001;
+	wheel_tick = (int64_t)floor(al_current_time() / wheel_resolution);
+
 	lua_newtable(lua_state);
 
 	// Set metatable
@@ -360,6 +911,10 @@ ALLEGRO_EVENT_SOURCE* scheduler_init()
 	scheduler_change_timestamp(handle, 10, 0);
 #endif
 
+#ifdef SCHEDULER_BENCHMARK
+	scheduler_benchmark();
+#endif
+
 	al_init_user_event_source(&scheduler_event_source);
 
 	return &scheduler_event_source;
@@ -367,96 +922,189 @@ ALLEGRO_EVENT_SOURCE* scheduler_init()
 
 // Public Scheduler Interface
 
-// Push an item into the scheduler, maintains the heap property
+// Push an item into the scheduler
+// Off the main thread the item goes through scheduler_push_async instead and there is no handle.
 struct scheduler_interface* scheduler_push(double timestamp, void(*funct)(void*), void* data)
 {
-	if (allocated <= used)
+	if (!main_thread)
 	{
-		const size_t new_cnt = 2 * allocated + 1;
-
-		struct scheduler_interface** memsafe_hande = realloc(heap, new_cnt * sizeof(struct scheduler_interface*));
+		if (!scheduler_push_async(timestamp, funct, data))
+			fprintf(stderr, "failed to stage scheduler item!\n");
 
-		if (!memsafe_hande)
-			return NULL;
-
-		heap = memsafe_hande;
-		allocated = new_cnt;
+		return NULL;
 	}
 
-	struct scheduler_interface* item = malloc(sizeof(struct scheduler_interface));
+	return scheduler_push_periodic(timestamp, 0, 0, funct, data);
+}
+
+// Push an item into the scheduler that first fires after timestamp then every interval until popped
+// An interval of 0 fires once. The item may fire up to slack late so nearby timers share a wake up.
+struct scheduler_interface* scheduler_push_periodic(double timestamp, double interval, double slack, void(*funct)(void*), void* data)
+{
+	struct scheduler_interface* item = scheduler_alloc_node();
 
 	if (!item)
 		return NULL;
 
+	const double due = timestamp + current_timestamp;
+
 	*item = (struct scheduler_interface)
 	{
-		.timestamp = timestamp + current_timestamp,
+		.timestamp = scheduler_deadline(due, slack),
 		.funct = funct,
-		.data = data
+		.data = data,
+		.due = due,
+		.interval = interval > 0 ? interval : 0,
+		.slack = slack > 0 ? slack : 0,
+		.index = SCHEDULER_NO_INDEX
 	};
 
-	heap_insert(item);
+	if (!backend->insert(item))
+	{
+		scheduler_free_node(item);
+		return NULL;
+	}
 
 	return item;
 }
 
-// Remove an item from the scheudler, maintains the heap property
-void scheduler_pop(struct scheduler_interface* item)
+// Does nothing, dispatched to wake the main thread
+static void scheduler_wake(void* _)
 {
-	const size_t node = heap_find(0, item);
+}
 
-	if (node == 0)
+// The next time the main loop has to run for the scheduler, for waiting when there is nothing else to do
+// Until the next scheduler_generate_events a push from another thread emits an event to end the wait.
+double scheduler_idle_deadline()
+{
+	atomic_store(&staging_wake, true);
+
+	const struct staging_cell* const cell = staging + (staging_head & (STAGING_SIZE - 1));
+
+	if (atomic_load(&cell->sequence) == staging_head + 1)
+		return -INFINITY;
+
+	return backend->next();
+}
+
+// Push an item into the scheduler from any thread
+// The item is merged at the start of the next scheduler_generate_events, its delay counts from then.
+// There is no handle since the item doesn't exist yet. Returns false if the staging ring is full.
+bool scheduler_push_async(double timestamp, void(*funct)(void*), void* data)
+{
+	size_t position = atomic_load_explicit(&staging_tail, memory_order_relaxed);
+
+	while (1)
 	{
-		if (used >= 1 && item == heap[0])
+		struct staging_cell* const cell = staging + (position & (STAGING_SIZE - 1));
+		const size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+
+		if (sequence == position)
 		{
-			scheduler_free_node(0);
-			heap_pop();
+			// The cell is free, claim it
+			if (atomic_compare_exchange_weak_explicit(&staging_tail, &position, position + 1,
+				memory_order_relaxed, memory_order_relaxed))
+			{
+				cell->delay = timestamp;
+				cell->funct = funct;
+				cell->data = data;
+
+				atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+
+				// Pairs with scheduler_idle_deadline, either it sees the cell or we see the flag
+				if (atomic_exchange(&staging_wake, false))
+				{
+					ALLEGRO_EVENT ev;
+					ev.type = ALLEGRO_GET_EVENT_TYPE('T', 'I', 'M', 'E');
+					ev.user.data1 = (intptr_t)scheduler_wake;
+					ev.user.data2 = (intptr_t)NULL;
+
+					al_emit_user_event(&scheduler_event_source, &ev, NULL);
+				}
+
+				return true;
+			}
 		}
+		else if (sequence < position)
+			return false;
+		else
+			position = atomic_load_explicit(&staging_tail, memory_order_relaxed);
+	}
+}
 
+// Remove an item from the scheudler
+// Does nothing if the item isn't scheduled.
+void scheduler_pop(struct scheduler_interface* item)
+{
+	if (!backend->contains(item))
 		return;
-	}
 
-	heap_remove(node);
-	scheduler_free_node(used);
+	backend->remove(item);
+	scheduler_free_node(item);
 }
 
-// Change the timestap of an item, maintains the heap property
+// Change the timestap of an item
+// Does nothing if the item isn't scheduled.
 void scheduler_change_timestamp(struct scheduler_interface* item, double time, int flag)
 {
-	const size_t node = heap_find(0, item);
-
-	if (node == 0 && (used == 0 || item != heap[0]))
+	if (!backend->contains(item))
 		return;
 
-	item->timestamp += time;
-	heap_heapify(node);
+	item->due += time;
+	item->timestamp = scheduler_deadline(item->due, item->slack);
+	backend->update(item);
 }
 
-// Check the current timers and generate any relevent events
+// Merge the timers pushed from other threads then check the current timers and generate any relevent events
+// Only merges in batch mode, the main loop collects and runs the timers itself.
 void scheduler_generate_events()
 {
+	atomic_store(&staging_wake, false);
+	scheduler_merge_staging();
+
+	if (batch_mode)
+		return;
+
 	const double _current_time = al_current_time();
+	expire_time = _current_time;
 
 #ifdef SCHEDULER_TESTING
 	printf("Scheduler_event: time %f %zd\n", _current_time, used);
 	scheduler_dump();
 #endif
 
-	while (heap[0] && heap[0]->timestamp < _current_time)
-	{
-		ALLEGRO_EVENT ev;
-		ev.type = ALLEGRO_GET_EVENT_TYPE('T', 'I', 'M', 'E');
-		ev.user.data1 = (intptr_t)heap[0]->funct;
-		ev.user.data2 = (intptr_t)heap[0]->data;
-
-		al_emit_user_event(&scheduler_event_source, &ev, NULL);
-
-		scheduler_free_node(0);
-
-		heap_pop();
-	}
+	backend->expire(_current_time, scheduler_fire);
 
 #ifdef SCHEDULER_TESTING
 	printf("\n");
 #endif
 }
+
+// Take every timer due before the timestamp out of the scheduler, returns how many there are to run
+// Always 0 outside of batch mode.
+size_t scheduler_batch_collect(double timestamp)
+{
+	if (!batch_mode)
+		return 0;
+
+	expire_time = timestamp;
+	backend->expire(timestamp, scheduler_batch_add);
+
+	// The heap already expires in order, the wheel only to the tick
+	if (backend == &wheel_backend)
+		qsort(batch, batch_used, sizeof(struct scheduler_batch_item), scheduler_batch_compare);
+
+	return batch_used;
+}
+
+// Run the collected timers in timestamp order
+// Timers they push go to the next batch.
+void scheduler_batch_run()
+{
+	const size_t cnt = batch_used;
+
+	for (size_t i = 0; i < cnt; i++)
+		batch[i].funct(batch[i].data);
+
+	batch_used = 0;
+}
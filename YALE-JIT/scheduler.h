@@ -3,6 +3,23 @@
 // license that can be found in the LICENSE file.
 #pragma once
 
+#include <stdbool.h>
+
+enum scheduler_backend_type
+{
+	SCHEDULER_HEAP,		// Binary heap, timers fire in exact timestamp order
+	SCHEDULER_WHEEL		// Hierarchical timing wheel, O(1) but timers fire up to one resolution late
+};
+
+struct scheduler_config
+{
+	enum scheduler_backend_type backend;
+	double resolution;	// Seconds per timing wheel slot
+	bool batch;			// Run due timers directly in one batch per pass instead of an event each
+};
+
 struct scheduler_interface* scheduler_push(double, void(*)(void*), void*);
+struct scheduler_interface* scheduler_push_periodic(double, double, double, void(*)(void*), void*);
+bool scheduler_push_async(double, void(*)(void*), void*);
 void scheduler_pop(struct scheduler_interface*);
 void scheduler_change_timestamp(struct scheduler_interface*, double, int);
\ No newline at end of file
@@ -79,6 +79,11 @@ static void mask(const struct wg_base* const wg)
 		al_map_rgb(255,255,255));
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	return wg_hit_rounded_rectangle(wg, primary_pallet.edge_radius, x, y);
+}
+
 static void left_held(struct wg_base* const wg)
 {
 	struct slider* const slider = (const struct slider* const)wg;
@@ -186,6 +191,7 @@ const struct wg_jumptable_hud slider_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 	.left_held = left_held,
 
 	.left_click = left_click,
@@ -98,6 +98,13 @@ static void mask(const struct wg_base* const wg)
 		al_map_rgb(255, 0, 0));
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	const struct text_entry* const text_entry = (const struct text_entry* const)wg;
+
+	return wg_hit_rounded_rectangle(wg, text_entry->pallet->edge_radius, x, y);
+}
+
 static void drag_start(struct wg_base* const wg)
 {
 	struct text_entry* const text_entry = (const struct text_entry* const)wg;
@@ -119,20 +126,23 @@ static void click_off(struct wg_base* const wg)
 	text_entry->hud_state = HUD_IDLE;
 }
 
-static void event_handler(struct wg_base* const wg)
+// Editing the text doesn't change the mask, only on_enter can change what picking sees.
+static bool event_handler(struct wg_base* const wg)
 {
 	struct text_entry* const text_entry = (const struct text_entry* const)wg;
 
 	if (text_entry->hud_state != HUD_ACTIVE)
-		return;
+		return false;
 
 	if (current_event.type == ALLEGRO_EVENT_KEY_CHAR)
 	{
 		if (current_event.keyboard.keycode == ALLEGRO_KEY_ENTER)
 		{
-			if (text_entry->on_enter)
-				text_entry->on_enter(text_entry);
-			return;
+			if (!text_entry->on_enter)
+				return false;
+
+			text_entry->on_enter(text_entry);
+			return true;
 		}
 
 		if (current_event.keyboard.keycode == ALLEGRO_KEY_BACKSPACE)
@@ -140,7 +150,7 @@ static void event_handler(struct wg_base* const wg)
 			if (text_entry->input_size > 0)
 				text_entry->input[--text_entry->input_size] = '\0';
 
-			return;
+			return false;
 		}
 
 		if (text_entry->input_size < 255)
@@ -197,6 +207,8 @@ static void event_handler(struct wg_base* const wg)
 			}
 		}
 	}
+
+	return false;
 }
 
 const struct wg_jumptable_base text_entry_jumptable =
@@ -205,6 +217,7 @@ const struct wg_jumptable_base text_entry_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 	.event_handler = event_handler,
 
 	.left_click = left_click,
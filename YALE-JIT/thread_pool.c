@@ -2,32 +2,221 @@
 // Use of this source code is governed by an MIT-style
 // license that can be found in the LICENSE file.
 
+#if defined(__linux__)
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <ucontext.h>
+#define THREAD_POOL_FIBERS
+#elif defined(_WIN32)
+#include <windows.h>
+#define THREAD_POOL_FIBERS
+#endif
+
+// #define THREAD_POOL_STATS
+// #define THREAD_POOL_TESTING
+
 #include "thread_pool.h"
+#include "trace.h"
 #include <allegro5/allegro.h>
 
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <assert.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define cpu_relax() _mm_pause()
+#else
+#define cpu_relax() ((void)0)
+#endif
+
+// Telemetry, compiled out unless THREAD_POOL_STATS is defined.
+// Each counter is only written by the thread that owns it so relaxed adds never contend.
+#ifdef THREAD_POOL_STATS
+#define STATS_DEPTH_BUCKETS 16
+#define STATS_PERIOD 5.0
+#define STATS_TIME(name) const double name = al_get_time()
+#define STATS_ADD(worker, field, value) atomic_fetch_add_explicit(&(worker)->stats.field, (value), memory_order_relaxed)
+#define STATS_ADD_TIME(worker, field, start) STATS_ADD(worker, field, (unsigned long long)((al_get_time() - (start)) * 1e6))
+#else
+#define STATS_TIME(name)
+#define STATS_ADD(worker, field, value)
+#define STATS_ADD_TIME(worker, field, start)
+#endif
+
+#if defined(_MSC_VER)
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+/*********************************************/
+/*                Frame Arena                */
+/*********************************************/
+
+// Work objects and work queues only live until the end of the frame that created them.
+// Rather than a malloc and free per work object they are bump allocated from a per thread arena.
+// The arenas are reset once per frame, keeping their chunks, so steady state use doesn't touch the heap.
+
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGNMENT 16
+
+struct arena_chunk
+{
+	struct arena_chunk* next;
+	size_t size;
+	size_t used;
+
+	_Alignas(ARENA_ALIGNMENT) char data[];
+};
+
+struct arena
+{
+	struct arena_chunk* first;
+	struct arena_chunk* current;
+};
+
+static struct arena_chunk* arena_chunk_create(size_t size, struct arena_chunk* next)
+{
+	struct arena_chunk* const chunk = malloc(sizeof(struct arena_chunk) + size);
+
+	if (!chunk)
+		return NULL;
+
+	*chunk = (struct arena_chunk)
+	{
+		.next = next,
+		.size = size,
+		.used = 0
+	};
+
+	return chunk;
+}
+
+static void* arena_alloc(struct arena* arena, size_t size)
+{
+	size = (size + ARENA_ALIGNMENT - 1) & ~(ARENA_ALIGNMENT - 1);
+
+	struct arena_chunk* chunk = arena->current;
+
+	// Move through the chunks kept from previous frames before allocating new ones.
+	while (chunk && chunk->size - chunk->used < size)
+	{
+		if (!chunk->next)
+		{
+			chunk = NULL;
+			break;
+		}
+
+		chunk = chunk->next;
+		chunk->used = 0;
+	}
+
+	if (!chunk)
+	{
+		chunk = arena_chunk_create(size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE, NULL);
+
+		if (!chunk)
+			return NULL;
+
+		if (arena->current)
+		{
+			for (struct arena_chunk* last = arena->current; ; last = last->next)
+				if (!last->next)
+				{
+					last->next = chunk;
+					break;
+				}
+		}
+		else
+			arena->first = chunk;
+	}
+
+	arena->current = chunk;
+
+	void* const output = chunk->data + chunk->used;
+	chunk->used += size;
+
+	return output;
+}
+
+// Reclaim everything allocated from the arena, the chunks are kept for reuse.
+static void arena_reset(struct arena* arena)
+{
+	arena->current = arena->first;
+
+	if (arena->current)
+		arena->current->used = 0;
+}
+
+static void arena_destroy(struct arena* arena)
+{
+	for (struct arena_chunk* a = arena->first, *b; a; a = b)
+	{
+		b = a->next;
+		free(a);
+	}
+
+	*arena = (struct arena){ 0 };
+}
+
+static void* thread_pool_alloc(size_t);
+
+/*********************************************/
+/*              Work and Queues              */
+/*********************************************/
+
 struct work
 {
 	void (*funct)(void*);
 	void* arg;
 	struct work* next;
+
+	struct thread_pool_fence* signal;	// Fence to signal once run, may be NULL
+	atomic_size_t unresolved;			// Number of fences that must complete before this can run
+	struct background_scope* scope;		// Background work this was pushed from, NULL for frame work
+	bool fiber;							// Run on a fiber so fence waits yield rather than hold the thread
 };
 
+// Background work can span frames so neither it nor the work it pushes can use the frame arenas.
+// Each background work object gets its own arena instead, freed once it and everything it pushed have finished.
+struct background_scope
+{
+	struct work work;					// The background work object itself
+	struct arena arena;
+	atomic_flag lock;					// Guards the arena, work in the scope can run on any thread
+	atomic_size_t refs;					// The background work plus each pushed work object that hasn't finished
+};
+
+static struct background_scope* scope_current();
+
 static struct work* work_create(void (*funct)(void*), void* arg)
 {
 	if (!funct)
 		return NULL;
 
-	struct work* const work = malloc(sizeof(struct work));
+	struct work* const work = thread_pool_alloc(sizeof(struct work));
+
+	if (!work)
+		return NULL;
 
 	*work = (struct work)
 	{
 		.funct = funct,
 		.arg = arg,
-		.next = NULL
+		.next = NULL,
+		.signal = NULL,
+		.scope = scope_current(),
+		.fiber = false
 	};
 
+	atomic_init(&work->unresolved, 0);
+
 	return work;
 }
 
@@ -40,7 +229,11 @@ struct work_queue
 // Create an empty work queue
 struct work_queue* work_queue_create()
 {
-	struct work_queue* const output = malloc(sizeof(struct work_queue));
+	struct work_queue* const output = thread_pool_alloc(sizeof(struct work_queue));
+
+	if (!output)
+		return NULL;
+
 	output->first = NULL;
 	output->last = NULL;
 
@@ -78,203 +271,1553 @@ void work_queue_concatenate(struct work_queue* dst, struct work_queue* src)
 
 	if(src->last)
 		dst->last = src->last;
-
-	free(src);
 }
 
-// Pop a work object from the queue
-static struct work* work_queue_pop(struct work_queue* queue)
+// Simply run the work queue in the calling thread.
+void work_queue_run(struct work_queue* queue)
 {
 	if (!queue || !queue->first)
-		return NULL;
+		return;
 
-	struct work* const work = queue->first;
+	for (struct work* work = queue->first; work; work = work->next)
+		work->funct(work->arg);
+}
 
-	if (!(queue->first = work->next))
-		queue->last = NULL;
+// Discard a work queue without running it.
+// The memory belongs to the frame arena and is reclaimed by thread_pool_frame_reset.
+void work_queue_destroy(struct work_queue* queue)
+{
+	if (!queue)
+		return;
 
-	return work;
+	queue->first = NULL;
+	queue->last = NULL;
 }
 
-// Simply run the work queue in the calling thread.
-void work_queue_run(struct work_queue* queue)
+/*********************************************/
+/*            Work Stealing Deque            */
+/*********************************************/
+
+// A Chase-Lev deque.
+// The owning thread pushes and takes from the bottom, every other thread steals from the top.
+// Only the owner touches the bottom so the common case is free of any read-modify-write.
+
+struct work_deque_buffer
 {
-	if (!queue || !queue->first)
-		return;
+	int64_t mask;
+	struct work_deque_buffer* retired;	// Buffers outgrown by the deque, thieves may still be reading them.
+	_Atomic(struct work*) slots[];
+};
+
+struct work_deque
+{
+	atomic_int_least64_t top;
+	atomic_int_least64_t bottom;
+	_Atomic(struct work_deque_buffer*) buffer;
+};
 
-	struct work* work = queue->first;
-	struct work* next = NULL;
+static struct work_deque_buffer* work_deque_buffer_create(int64_t size, struct work_deque_buffer* retired)
+{
+	struct work_deque_buffer* const buffer = malloc(sizeof(struct work_deque_buffer) + size * sizeof(_Atomic(struct work*)));
 
-	while (work)
-	{
-		work->funct(work->arg);
-		next = work->next;
-		free(work);
-		work = next;
-	}
+	if (!buffer)
+		return NULL;
+
+	buffer->mask = size - 1;
+	buffer->retired = retired;
+
+	return buffer;
 }
 
-// Free a work queue and all its constituent work objects.
-// Not used in normal workflow as work queues are meant to concatenated to thread pools.
-void work_queue_destroy(struct work_queue* queue)
+// Returns false if the buffer couldn't be allocated.
+static bool work_deque_init(struct work_deque* deque)
+{
+	struct work_deque_buffer* const buffer = work_deque_buffer_create(256, NULL);
+
+	atomic_init(&deque->top, 0);
+	atomic_init(&deque->bottom, 0);
+	atomic_init(&deque->buffer, buffer);
+
+	return buffer;
+}
+
+// Free the deque buffers, doesn't free any work objects still in the deque.
+static void work_deque_destroy(struct work_deque* deque)
 {
-	for (struct work* a = queue->first, *b; a; a = b)
+	for (struct work_deque_buffer* a = atomic_load(&deque->buffer), *b; a; a = b)
 	{
-		b = a->next;
+		b = a->retired;
 		free(a);
 	}
-
-	free(queue);
 }
 
-struct thread_pool
+// Double the capacity of the deque, only called by the owner.
+static struct work_deque_buffer* work_deque_grow(struct work_deque* deque, struct work_deque_buffer* buffer, int64_t top, int64_t bottom)
 {
-	struct work_queue queue;			// Current work queue
+	struct work_deque_buffer* const grown = work_deque_buffer_create(2 * (buffer->mask + 1), buffer);
 
-	ALLEGRO_MUTEX* read_write_mutex;	// Read/Write lock
-	ALLEGRO_COND* pending_work_cond;	// Signal to threads that there is work to do.
-	ALLEGRO_COND* idle_cond;			// Signal that there is no thread working.	
+	if (!grown)
+		return NULL;
 
-	size_t working_cnt;					// Number of workering threads
-	size_t thread_cnt;					// Number of total threads
+	for (int64_t i = top; i < bottom; i++)
+		atomic_store_explicit(grown->slots + (i & grown->mask),
+			atomic_load_explicit(buffer->slots + (i & buffer->mask), memory_order_relaxed),
+			memory_order_relaxed);
 
-	bool shutting_down;					// The thread pool is signaled to be destroyed
-};
+	atomic_store_explicit(&deque->buffer, grown, memory_order_release);
 
-static struct thread_pool thread_pool;
+	return grown;
+}
 
-static void* worker_function(void* arg)
+// Push a work object to the bottom of the deque, only called by the owner.
+static bool work_deque_push(struct work_deque* deque, struct work* work)
 {
-	while (1)
-	{
-		al_lock_mutex(thread_pool.read_write_mutex);
+	const int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed);
+	const int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	struct work_deque_buffer* buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
 
-		while (!thread_pool.queue.first && !thread_pool.shutting_down)
-			al_wait_cond(thread_pool.pending_work_cond, thread_pool.read_write_mutex);
+	if (bottom - top > buffer->mask)
+		if (!(buffer = work_deque_grow(deque, buffer, top, bottom)))
+			return false;
 
-		if (thread_pool.shutting_down)
-		{
-			thread_pool.thread_cnt--;
-			al_signal_cond(thread_pool.idle_cond);
-			al_unlock_mutex(thread_pool.read_write_mutex);
+	atomic_store_explicit(buffer->slots + (bottom & buffer->mask), work, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
 
-			return NULL;
-		}
+	return true;
+}
 
-		struct work* const work = work_queue_pop(&thread_pool.queue);
-		thread_pool.working_cnt++;
-		al_unlock_mutex(thread_pool.read_write_mutex);
+// Take a work object from the bottom of the deque, only called by the owner.
+static struct work* work_deque_take(struct work_deque* deque)
+{
+	const int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_relaxed) - 1;
+	struct work_deque_buffer* const buffer = atomic_load_explicit(&deque->buffer, memory_order_relaxed);
 
-		if (work)
-		{
-			work->funct(work->arg);
-			free(work);
-		}
+	atomic_store_explicit(&deque->bottom, bottom, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_relaxed);
+
+	if (top > bottom)
+	{
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
+		return NULL;
+	}
 
-		al_lock_mutex(thread_pool.read_write_mutex);
-		thread_pool.working_cnt--;
+	struct work* work = atomic_load_explicit(buffer->slots + (bottom & buffer->mask), memory_order_relaxed);
 
-		if (!thread_pool.shutting_down && thread_pool.working_cnt == 0 && !thread_pool.queue.first)
-			al_signal_cond(thread_pool.idle_cond);
+	if (top == bottom)
+	{
+		// Last item, race the thieves for it.
+		if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+			memory_order_seq_cst, memory_order_relaxed))
+			work = NULL;
 
-		al_unlock_mutex(thread_pool.read_write_mutex);
+		atomic_store_explicit(&deque->bottom, bottom + 1, memory_order_relaxed);
 	}
+
+	return work;
 }
 
-// Create and detach the thread pool
-// Only visable to the main thread
-void thread_pool_create(int thread_cnt)
+// Steal a work object from the top of the deque, called by any thread.
+// Returns NULL when the deque is empty or the steal lost a race.
+static struct work* work_deque_steal(struct work_deque* deque)
 {
-	if (thread_cnt <= 0)
-		thread_cnt = 8;
+	int64_t top = atomic_load_explicit(&deque->top, memory_order_acquire);
+	atomic_thread_fence(memory_order_seq_cst);
+	const int64_t bottom = atomic_load_explicit(&deque->bottom, memory_order_acquire);
 
-	thread_pool = (struct thread_pool)
-	{
-		.queue.first = NULL,
-		.queue.last = NULL,
+	if (top >= bottom)
+		return NULL;
 
-		.thread_cnt = thread_cnt,
-		.working_cnt = 0,
+	struct work_deque_buffer* const buffer = atomic_load_explicit(&deque->buffer, memory_order_acquire);
+	struct work* const work = atomic_load_explicit(buffer->slots + (top & buffer->mask), memory_order_relaxed);
 
-		.shutting_down = false,
+	if (!atomic_compare_exchange_strong_explicit(&deque->top, &top, top + 1,
+		memory_order_seq_cst, memory_order_relaxed))
+		return NULL;
 
-		.read_write_mutex = al_create_mutex(),
-		.pending_work_cond = al_create_cond(),
-		.idle_cond = al_create_cond()
-	};
+	return work;
+}
 
-	for (int i = 0; i < thread_cnt; i++)
-		al_run_detached_thread(worker_function, NULL);
+static bool work_deque_empty(struct work_deque* deque)
+{
+	return atomic_load(&deque->top) >= atomic_load(&deque->bottom);
 }
 
-// Destroy the thread pool.
-// Destroys any work objects that are in the queue but not being executed.
-// Only visable to the main thread.
-void thread_pool_destroy()
+/*********************************************/
+/*                  Fibers                   */
+/*********************************************/
+
+// Work runs on the stack of the thread that takes it, a fence wait there runs other work until the fence completes.
+// Work pushed with thread_pool_push_fiber instead runs on a fiber, its own small stack.
+// A fiber waiting on a fence switches back to its thread which parks it on the fence and goes on with other work,
+// once the fence completes the fiber is pushed like any other work and resumed by whichever thread takes it.
+// Platforms without fibers run fiber work on the thread's stack and fence waits help instead.
+
+#define FIBER_STACK_SIZE 262144
+
+#if defined(_WIN32)
+typedef void* fiber_context;
+#elif defined(THREAD_POOL_FIBERS)
+typedef ucontext_t fiber_context;
+#else
+typedef char fiber_context;
+#endif
+
+struct fiber
 {
-	al_lock_mutex(thread_pool.read_write_mutex);
+	fiber_context context;
+	void* stack;
 
-	work_queue_destroy(&thread_pool.queue);
-	thread_pool.shutting_down = true;
+	struct work* work;					// Work to run next, NULL once it has run
+	struct thread_pool_fence* wait;		// Fence the fiber yielded on, NULL if it finished its work
 
-	al_signal_cond(thread_pool.pending_work_cond);
-	al_unlock_mutex(thread_pool.read_write_mutex);
+	struct fiber* next;					// Next free fiber of the worker
+	struct fiber* created_next;			// Next fiber created by the same worker
+};
 
-	thread_pool_wait();
+static void fiber_main();
 
-	al_destroy_mutex(thread_pool.read_write_mutex);
-	al_destroy_cond(thread_pool.pending_work_cond);
-	al_destroy_cond(thread_pool.idle_cond);
+#if defined(_WIN32)
+static void __stdcall fiber_proc(void* _)
+{
+	fiber_main();
 }
+#endif
 
-// Create and push a work object to the thread pool.
-void thread_pool_push(void (*funct)(void*), void* arg)
+// Make the calling thread able to switch to fibers.
+static bool fiber_thread_init(fiber_context* context)
 {
-	al_lock_mutex(thread_pool.read_write_mutex);
-	work_queue_push(&thread_pool.queue, funct, arg);
-	al_signal_cond(thread_pool.pending_work_cond);
-	al_unlock_mutex(thread_pool.read_write_mutex);
+#if defined(_WIN32)
+	return (*context = ConvertThreadToFiber(NULL)) != NULL;
+#elif defined(THREAD_POOL_FIBERS)
+	return true;
+#else
+	return false;
+#endif
 }
 
-// Wait for the queue to be empty and all workers be idle.
-void thread_pool_wait()
+static void fiber_thread_exit()
 {
-	al_lock_mutex(thread_pool.read_write_mutex);
+#if defined(_WIN32)
+	ConvertFiberToThread();
+#endif
+}
 
-	while (1)
-		if ((!thread_pool.shutting_down && thread_pool.queue.first) ||
-			(thread_pool.shutting_down && thread_pool.thread_cnt != 0))
-			al_wait_cond(thread_pool.idle_cond, thread_pool.read_write_mutex);
-		else
-			break;
+static bool fiber_context_create(struct fiber* fiber)
+{
+#if defined(_WIN32)
+	return (fiber->context = CreateFiber(FIBER_STACK_SIZE, fiber_proc, fiber)) != NULL;
+#elif defined(THREAD_POOL_FIBERS)
+	if (!(fiber->stack = malloc(FIBER_STACK_SIZE)))
+		return false;
 
-	al_unlock_mutex(thread_pool.read_write_mutex);
+	getcontext(&fiber->context);
+	fiber->context.uc_stack.ss_sp = fiber->stack;
+	fiber->context.uc_stack.ss_size = FIBER_STACK_SIZE;
+	fiber->context.uc_link = NULL;
+	makecontext(&fiber->context, fiber_main, 0);
+
+	return true;
+#else
+	return false;
+#endif
 }
 
-// Concatenate a work queue on to the thread pool.
-// Frees the non-work object memory associated with the queue.
-// The work objects memory is now managed by the thread pool.
-void thread_pool_concatenate(struct work_queue* queue)
+static void fiber_context_destroy(struct fiber* fiber)
 {
-	if (queue->first)
+#if defined(_WIN32)
+	DeleteFiber(fiber->context);
+#else
+	free(fiber->stack);
+#endif
+}
+
+// Save the current context to from and continue from to.
+static void fiber_context_switch(fiber_context* from, fiber_context* to)
+{
+#if defined(_WIN32)
+	SwitchToFiber(*to);
+#elif defined(THREAD_POOL_FIBERS)
+	swapcontext(from, to);
+#endif
+}
+
+/*********************************************/
+/*                Thread Pool                */
+/*********************************************/
+
+#ifdef THREAD_POOL_STATS
+struct worker_stats
+{
+	atomic_ullong busy_us;				// Time running frame work
+	atomic_ullong idle_us;				// Time spinning or sleeping
+	atomic_ullong background_us;		// Time running background work
+	atomic_ullong jobs;					// Frame work objects run
+	atomic_ullong steals;				// Work objects taken from another deque
+	atomic_ullong waits;				// Times the thread slept or parked
+
+	// Depth of the pushing thread's deque at submit time, bucketed by bit length.
+	atomic_ullong depth[STATS_DEPTH_BUCKETS];
+
+	unsigned long long last_busy_us;	// Totals at the last dump, only used by the main thread
+	unsigned long long last_idle_us;
+};
+#endif
+
+// Each thread in the pool owns a deque, as does the main thread (worker 0).
+// Work is pushed to the deque of the pushing thread and idle threads steal from the others.
+struct worker
+{
+	struct work_deque deque;
+	struct arena arena;					// Frame arena for work pushed by this thread
+	fiber_context context;				// Context of the thread, fibers switch back to it when they finish or yield
+	struct fiber* fiber;				// Fiber currently running on the thread, NULL if none
+	struct fiber* free_fibers;			// Fibers ready to run new work
+	struct fiber* fibers;				// Every fiber created by the thread
+	bool fiber_ready;					// The thread can switch to fibers
+	struct background_scope* scope;		// Scope of the work running on the thread, NULL for frame work
+
+#ifdef THREAD_POOL_STATS
+	struct worker_stats stats;
+#endif
+	size_t index;
+	uint32_t random;					// Xorshift state used to pick steal victims.
+
+	char padding[64];					// Keep the deques on seperate cache lines.
+};
+
+struct thread_pool
+{
+	struct worker* workers;				// Main thread deque followed by the worker deques
+	size_t worker_cnt;					// Number of deques
+
+	ALLEGRO_MUTEX* sleep_mutex;			// Guards sleeping and waking
+	ALLEGRO_COND* pending_work_cond;	// Signal to threads that there is work to do.
+	ALLEGRO_COND* idle_cond;			// Signal that all pushed work has completed.
+
+	ALLEGRO_MUTEX* background_mutex;	// Guards the background lane
+	struct work* background_first;		// Background lane, FIFO of work that isn't needed by the frame
+	struct work* background_last;
+
+	atomic_size_t pending_cnt;			// Number of pushed frame work objects that haven't finished
+	atomic_size_t background_cnt;		// Number of work objects in the background lane
+	atomic_llong background_used_us;	// Microseconds of background work run this frame
+	long long background_budget_us;		// Microseconds of background work allowed per frame, 0 or less is unlimited
+	atomic_size_t sleeping_cnt;			// Number of threads waiting on pending_work_cond
+	atomic_size_t parked_cnt;			// Number of threads waiting on idle_cond
+	size_t thread_cnt;					// Number of total threads
+	size_t grain;						// Default number of items per parallel for chunk
+	double spin_time;					// Seconds an idle thread spins before sleeping
+	bool affinity;						// Pin worker threads to cpus
+
+	atomic_bool shutting_down;			// The thread pool is signaled to be destroyed
+};
+
+static struct thread_pool thread_pool;
+
+// The worker owned by the calling thread, NULL for threads outside the pool.
+static _Thread_local struct worker* current_worker;
+
+// The worker of the calling thread.
+// Deques and arenas are only safe for their owner, so threads outside the pool have none to fall back on:
+// they may push background work but not frame work, fences or waits.
+// Never inlined since fibers can move between threads, the thread local must be read again after every switch.
+static NOINLINE struct worker* worker_current()
+{
+	assert(current_worker);
+
+	return current_worker;
+}
+
+static inline uint32_t worker_random(struct worker* worker)
+{
+	uint32_t x = worker->random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return worker->random = x;
+}
+
+// Is there any work in any of the deques.
+static bool work_available()
+{
+	for (size_t i = 0; i < thread_pool.worker_cnt; i++)
+		if (!work_deque_empty(&thread_pool.workers[i].deque))
+			return true;
+
+	return false;
+}
+
+// Find work, first from our own deque then by stealing from a random victim onwards.
+static struct work* worker_find_work(struct worker* worker)
+{
+	struct work* work = work_deque_take(&worker->deque);
+
+	if (work)
+		return work;
+
+	const size_t cnt = thread_pool.worker_cnt;
+	const size_t start = worker_random(worker) % cnt;
+
+	for (size_t i = 0; i < cnt; i++)
 	{
-		al_lock_mutex(thread_pool.read_write_mutex);
+		struct worker* const victim = thread_pool.workers + (start + i) % cnt;
 
-		if (thread_pool.queue.last)
-		{
-			thread_pool.queue.last->next = queue->first;
-		}
-		else
+		if (victim == worker)
+			continue;
+
+		if (work = work_deque_steal(&victim->deque))
 		{
-			thread_pool.queue.first = queue->first;
+			STATS_ADD(worker, steals, 1);
+			return work;
 		}
+	}
+
+	return NULL;
+}
+
+// Wake sleeping threads after new work has been pushed.
+static void worker_notify(bool all)
+{
+	// Pairs with the fence in worker_sleep so either we see the sleeper or it sees the work.
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&thread_pool.sleeping_cnt, memory_order_relaxed) == 0)
+		return;
 
-		if(queue->last)
-			thread_pool.queue.last = queue->last;
+	al_lock_mutex(thread_pool.sleep_mutex);
 
+	if (all)
+		al_broadcast_cond(thread_pool.pending_work_cond);
+	else
 		al_signal_cond(thread_pool.pending_work_cond);
-		al_unlock_mutex(thread_pool.read_write_mutex);
-	}
 
-	free(queue);
-}
\ No newline at end of file
+	al_unlock_mutex(thread_pool.sleep_mutex);
+}
+
+// Is there background work and budget left this frame to run it.
+static bool background_available(void* _)
+{
+	if (atomic_load(&thread_pool.background_cnt) == 0)
+		return false;
+
+	return thread_pool.background_budget_us <= 0 ||
+		atomic_load_explicit(&thread_pool.background_used_us, memory_order_relaxed) < thread_pool.background_budget_us;
+}
+
+static bool pool_idle(void* _)
+{
+	return atomic_load(&thread_pool.pending_cnt) == 0;
+}
+
+// Completion latch.
+// Waiters only take sleep_mutex once spinning has failed and they are about to park,
+// and whatever completes a wait condition only takes it when a waiter is actually parked.
+
+// Wake any parked waiters after a wait condition may have become true.
+static void latch_release()
+{
+	// Pairs with the fence in latch_park so either we see the waiter or it sees the completion.
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(&thread_pool.parked_cnt, memory_order_relaxed) == 0)
+		return;
+
+	al_lock_mutex(thread_pool.sleep_mutex);
+	al_broadcast_cond(thread_pool.idle_cond);
+	al_unlock_mutex(thread_pool.sleep_mutex);
+}
+
+// Sleep until done returns true or there is work to help with.
+static void latch_park(bool (*done)(void*), void* arg)
+{
+	STATS_ADD(worker_current(), waits, 1);
+
+	al_lock_mutex(thread_pool.sleep_mutex);
+
+	atomic_fetch_add(&thread_pool.parked_cnt, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	while (!done(arg) && !work_available())
+		al_wait_cond(thread_pool.idle_cond, thread_pool.sleep_mutex);
+
+	atomic_fetch_sub(&thread_pool.parked_cnt, 1);
+
+	al_unlock_mutex(thread_pool.sleep_mutex);
+}
+
+static struct background_scope* scope_current()
+{
+	return worker_current()->scope;
+}
+
+// Drop a reference to the scope, freeing it and everything allocated in it with the last.
+static void scope_release(struct background_scope* scope)
+{
+	if (atomic_fetch_sub(&scope->refs, 1) != 1)
+		return;
+
+	arena_destroy(&scope->arena);
+	free(scope);
+}
+
+// Count cnt work objects of the scope as pushed, frame work is what thread_pool_wait waits on.
+static void work_pending(struct background_scope* scope, size_t cnt)
+{
+	if (scope)
+		atomic_fetch_add(&scope->refs, cnt);
+	else
+		atomic_fetch_add(&thread_pool.pending_cnt, cnt);
+}
+
+// Mark a pushed work object of the scope as complete and wake the waiters if it was the last frame work.
+static void work_done(struct background_scope* scope)
+{
+	if (scope)
+		scope_release(scope);
+	else if (atomic_fetch_sub(&thread_pool.pending_cnt, 1) == 1)
+		latch_release();
+}
+
+static void fence_signal(struct thread_pool_fence*);
+
+// Run a work object.
+// Once done the work object may be freed along with its scope, so it's read up front.
+static void worker_run(struct work* work)
+{
+	struct background_scope* const scope = work->scope;
+	struct thread_pool_fence* const signal = work->signal;
+
+	worker_current()->scope = scope;
+
+	TRACE_BEGIN(trace_begin);
+	work->funct(work->arg);
+	TRACE_END(trace_begin, "job", NULL, (const void*)work->funct);
+
+	if (signal)
+		fence_signal(signal);
+
+	work_done(scope);
+}
+
+static bool fiber_park(struct fiber*, struct thread_pool_fence*);
+
+// Marks a work object that resumes the fiber in its arg, it's never actually called.
+static void fiber_resume(void* _)
+{
+}
+
+// Runs on every fiber, each pass runs the fiber's work then hands the fiber back to its thread.
+static void fiber_main()
+{
+	while (1)
+	{
+		struct fiber* const fiber = worker_current()->fiber;
+
+		worker_run(fiber->work);
+		fiber->work = NULL;
+
+		fiber_context_switch(&fiber->context, &worker_current()->context);
+	}
+}
+
+// Get a fiber to run new work, NULL if the thread can't use fibers or one can't be made.
+static struct fiber* fiber_acquire(struct worker* worker)
+{
+	if (!worker->fiber_ready)
+		return NULL;
+
+	struct fiber* fiber = worker->free_fibers;
+
+	if (fiber)
+	{
+		worker->free_fibers = fiber->next;
+		return fiber;
+	}
+
+	if (!(fiber = calloc(1, sizeof(struct fiber))))
+		return NULL;
+
+	if (!fiber_context_create(fiber))
+	{
+		free(fiber);
+		return NULL;
+	}
+
+	fiber->created_next = worker->fibers;
+	worker->fibers = fiber;
+
+	return fiber;
+}
+
+// Switch to the fiber until it finishes or yields on a fence.
+// A finished fiber is kept for reuse, a yielding one is parked on its fence.
+static void fiber_enter(struct worker* worker, struct fiber* fiber)
+{
+	while (1)
+	{
+		// The fiber may have been running on another thread, its work's scope comes with it.
+		worker->scope = fiber->work->scope;
+		worker->fiber = fiber;
+		fiber_context_switch(&worker->context, &fiber->context);
+		worker->fiber = NULL;
+
+		struct thread_pool_fence* const fence = fiber->wait;
+
+		if (!fence)
+		{
+			fiber->next = worker->free_fibers;
+			worker->free_fibers = fiber;
+			return;
+		}
+
+		fiber->wait = NULL;
+
+		// Parking only after the switch means the fiber can't be resumed while it's still running.
+		// If the fence completed in the meantime carry straight on.
+		if (fiber_park(fiber, fence))
+			return;
+	}
+}
+
+// Yield the calling fiber until the fence completes, it can be resumed on any thread.
+static void fiber_yield(struct fiber* fiber, struct thread_pool_fence* fence)
+{
+	fiber->wait = fence;
+	fiber_context_switch(&fiber->context, &worker_current()->context);
+}
+
+// Run or resume a work object taken from a deque.
+// The thread goes back to the scope it was in, work can be run while waiting inside other work.
+static void worker_execute(struct worker* worker, struct work* work)
+{
+	struct background_scope* const scope = worker->scope;
+
+	if (work->funct == fiber_resume)
+	{
+		fiber_enter(worker, (struct fiber*)work->arg);
+		worker->scope = scope;
+		return;
+	}
+
+	// Plain work, already on a fiber, or no fibers to be had, run on the current stack.
+	struct fiber* const fiber = work->fiber && !worker->fiber ? fiber_acquire(worker) : NULL;
+
+	if (!fiber)
+		worker_run(work);
+	else
+	{
+		fiber->work = work;
+		fiber_enter(worker, fiber);
+	}
+
+	worker->scope = scope;
+}
+
+// Take the oldest background work object if the budget allows it.
+// Frame work is always preferred, so only call this once worker_find_work has come back empty.
+static struct work* background_take()
+{
+	if (!background_available(NULL))
+		return NULL;
+
+	al_lock_mutex(thread_pool.background_mutex);
+
+	struct work* const work = thread_pool.background_first;
+
+	if (work)
+	{
+		thread_pool.background_first = work->next;
+
+		if (!thread_pool.background_first)
+			thread_pool.background_last = NULL;
+
+		atomic_fetch_sub(&thread_pool.background_cnt, 1);
+	}
+
+	al_unlock_mutex(thread_pool.background_mutex);
+
+	return work;
+}
+
+// Run a background work object and charge its run time to the frame budget.
+static void background_run(struct worker* worker, struct work* work)
+{
+	const double start = al_get_time();
+
+	worker->scope = work->scope;
+	work->funct(work->arg);
+	worker->scope = NULL;
+
+	TRACE_END(start, "background", NULL, (const void*)work->funct);
+	scope_release(work->scope);
+
+	const long long used_us = (long long)((al_get_time() - start) * 1e6);
+
+	atomic_fetch_add_explicit(&thread_pool.background_used_us, used_us, memory_order_relaxed);
+	STATS_ADD(worker_current(), background_us, used_us);
+}
+
+// Spin until there is work, done returns true, or the spin time runs out.
+// Short bursts of work every frame then don't pay for a sleep and wake up.
+static bool worker_spin(bool (*done)(void*), void* arg)
+{
+	if (thread_pool.spin_time <= 0)
+		return false;
+
+	const double deadline = al_get_time() + thread_pool.spin_time;
+
+	for (unsigned int i = 1; !atomic_load_explicit(&thread_pool.shutting_down, memory_order_relaxed); i++)
+	{
+		if (work_available() || (done && done(arg)))
+			return true;
+
+		cpu_relax();
+
+		// Reading the clock costs more than a pause, only check it every so often.
+		if (i % 64 == 0 && al_get_time() > deadline)
+			return false;
+	}
+
+	return false;
+}
+
+// Pin the calling thread to a cpu, best effort.
+static void worker_pin(size_t cpu)
+{
+#if defined(_WIN32)
+	SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (cpu % (8 * sizeof(DWORD_PTR))));
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu % CPU_SETSIZE, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+// Block until there is work or the pool is shutting down.
+// Returns false if the pool is shutting down.
+static bool worker_sleep()
+{
+	STATS_ADD(worker_current(), waits, 1);
+
+	al_lock_mutex(thread_pool.sleep_mutex);
+
+	atomic_fetch_add(&thread_pool.sleeping_cnt, 1);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	while (!atomic_load(&thread_pool.shutting_down) && !work_available() && !background_available(NULL))
+		al_wait_cond(thread_pool.pending_work_cond, thread_pool.sleep_mutex);
+
+	atomic_fetch_sub(&thread_pool.sleeping_cnt, 1);
+
+	if (atomic_load(&thread_pool.shutting_down))
+	{
+		thread_pool.thread_cnt--;
+		al_broadcast_cond(thread_pool.idle_cond);
+		al_unlock_mutex(thread_pool.sleep_mutex);
+
+		return false;
+	}
+
+	al_unlock_mutex(thread_pool.sleep_mutex);
+
+	return true;
+}
+
+static void* worker_function(void* arg)
+{
+	struct worker* const worker = (struct worker*)arg;
+	current_worker = worker;
+	trace_thread_name("worker", (int)worker->index);
+	worker->fiber_ready = fiber_thread_init(&worker->context);
+
+	// Worker 0 is the main thread, it keeps cpu 0.
+	if (thread_pool.affinity)
+		worker_pin(worker->index);
+
+	while (1)
+	{
+		struct work* const work = worker_find_work(worker);
+
+		if (work)
+		{
+			STATS_TIME(start);
+			worker_execute(worker, work);
+			STATS_ADD_TIME(worker, busy_us, start);
+			STATS_ADD(worker, jobs, 1);
+			continue;
+		}
+
+		// Only worker threads run background work, the main thread is always waiting on the frame.
+		struct work* const background = background_take();
+
+		if (background)
+		{
+			background_run(worker, background);
+			continue;
+		}
+
+		STATS_TIME(idle_start);
+		const bool running = worker_spin(background_available, NULL) || worker_sleep();
+		STATS_ADD_TIME(worker, idle_us, idle_start);
+
+		if (!running)
+		{
+			if (worker->fiber_ready)
+				fiber_thread_exit();
+
+			return NULL;
+		}
+	}
+}
+
+// Allocate from the frame arena of the calling thread, or the scope's arena when running background work.
+static void* thread_pool_alloc(size_t size)
+{
+	struct worker* const worker = worker_current();
+	struct background_scope* const scope = worker->scope;
+
+	if (!scope)
+		return arena_alloc(&worker->arena, size);
+
+	while (atomic_flag_test_and_set_explicit(&scope->lock, memory_order_acquire))
+		cpu_relax();
+
+	void* const memory = arena_alloc(&scope->arena, size);
+
+	atomic_flag_clear_explicit(&scope->lock, memory_order_release);
+
+	return memory;
+}
+
+// Push a work object to the deque of the calling thread.
+static void thread_pool_push_work(struct work* work)
+{
+	struct worker* const worker = worker_current();
+
+	if (!work_deque_push(&worker->deque, work))
+		worker_execute(worker, work);
+
+#ifdef THREAD_POOL_STATS
+	const int64_t size = atomic_load_explicit(&worker->deque.bottom, memory_order_relaxed) -
+		atomic_load_explicit(&worker->deque.top, memory_order_relaxed);
+	size_t depth = size > 0 ? (size_t)size : 0;
+	size_t bucket = 0;
+
+	for (; depth && bucket < STATS_DEPTH_BUCKETS - 1; depth >>= 1)
+		bucket++;
+
+	STATS_ADD(worker, depth[bucket], 1);
+#endif
+}
+
+#ifdef THREAD_POOL_TESTING
+static void thread_pool_test();
+#endif
+
+// Create and detach the thread pool
+// Only visable to the main thread
+// Returns false if the pool couldn't be allocated, no threads are started then.
+bool thread_pool_create(const struct thread_pool_config* config)
+{
+	int thread_cnt = config->thread_cnt;
+	int grain = config->grain;
+
+	// The main thread runs work while it waits, so leave it a cpu.
+	if (thread_cnt <= 0)
+	{
+		const int cpu_cnt = al_get_cpu_count();
+		thread_cnt = cpu_cnt > 1 ? cpu_cnt - 1 : cpu_cnt == 1 ? 1 : 8;
+	}
+
+	if (grain <= 0)
+		grain = 256;
+
+	thread_pool = (struct thread_pool)
+	{
+		.workers = calloc(thread_cnt + 1, sizeof(struct worker)),
+		.worker_cnt = thread_cnt + 1,
+
+		.thread_cnt = thread_cnt,
+		.grain = grain,
+		.spin_time = config->spin_us * 1e-6,
+		.affinity = config->affinity,
+		.background_budget_us = config->background_budget_us,
+
+		.sleep_mutex = al_create_mutex(),
+		.background_mutex = al_create_mutex(),
+		.pending_work_cond = al_create_cond(),
+		.idle_cond = al_create_cond()
+	};
+
+	atomic_init(&thread_pool.pending_cnt, 0);
+	atomic_init(&thread_pool.background_cnt, 0);
+	atomic_init(&thread_pool.background_used_us, 0);
+	atomic_init(&thread_pool.sleeping_cnt, 0);
+	atomic_init(&thread_pool.parked_cnt, 0);
+	atomic_init(&thread_pool.shutting_down, false);
+
+	size_t deque_cnt = 0;
+
+	if (thread_pool.workers)
+		for (; deque_cnt < thread_pool.worker_cnt; deque_cnt++)
+		{
+			struct worker* const worker = thread_pool.workers + deque_cnt;
+
+			if (!work_deque_init(&worker->deque))
+				break;
+
+			worker->index = deque_cnt;
+			worker->random = 2654435761u * (uint32_t)(deque_cnt + 1);
+		}
+
+	if (deque_cnt != thread_pool.worker_cnt)
+	{
+		for (size_t i = 0; i < deque_cnt; i++)
+			work_deque_destroy(&thread_pool.workers[i].deque);
+
+		free(thread_pool.workers);
+
+		al_destroy_mutex(thread_pool.sleep_mutex);
+		al_destroy_mutex(thread_pool.background_mutex);
+		al_destroy_cond(thread_pool.pending_work_cond);
+		al_destroy_cond(thread_pool.idle_cond);
+
+		thread_pool = (struct thread_pool){ 0 };
+
+		return false;
+	}
+
+	current_worker = thread_pool.workers;
+	thread_pool.workers->fiber_ready = fiber_thread_init(&thread_pool.workers->context);
+
+	for (size_t i = 1; i < thread_pool.worker_cnt; i++)
+		al_run_detached_thread(worker_function, thread_pool.workers + i);
+
+#ifdef THREAD_POOL_TESTING
+	thread_pool_test();
+#endif
+
+	return true;
+}
+
+// Destroy the thread pool.
+// Discards any work objects, frame or background, that are in the queue but not being executed.
+// Only visable to the main thread.
+void thread_pool_destroy()
+{
+	al_lock_mutex(thread_pool.sleep_mutex);
+
+	atomic_store(&thread_pool.shutting_down, true);
+	al_broadcast_cond(thread_pool.pending_work_cond);
+
+	while (thread_pool.thread_cnt != 0)
+		al_wait_cond(thread_pool.idle_cond, thread_pool.sleep_mutex);
+
+	al_unlock_mutex(thread_pool.sleep_mutex);
+
+	for (size_t i = 0; i < thread_pool.worker_cnt; i++)
+	{
+		work_deque_destroy(&thread_pool.workers[i].deque);
+		arena_destroy(&thread_pool.workers[i].arena);
+
+		for (struct fiber* fiber = thread_pool.workers[i].fibers, *next; fiber; fiber = next)
+		{
+			next = fiber->created_next;
+			fiber_context_destroy(fiber);
+			free(fiber);
+		}
+	}
+
+	if (thread_pool.workers->fiber_ready)
+		fiber_thread_exit();
+
+	free(thread_pool.workers);
+
+	for (struct work* work = thread_pool.background_first, *next; work; work = next)
+	{
+		next = work->next;
+		free(work);
+	}
+
+	al_destroy_mutex(thread_pool.sleep_mutex);
+	al_destroy_mutex(thread_pool.background_mutex);
+	al_destroy_cond(thread_pool.pending_work_cond);
+	al_destroy_cond(thread_pool.idle_cond);
+}
+
+// Create and push a work object to the thread pool.
+void thread_pool_push(void (*funct)(void*), void* arg)
+{
+	struct work* const work = work_create(funct, arg);
+
+	if (!work)
+		return;
+
+	work_pending(work->scope, 1);
+	thread_pool_push_work(work);
+	worker_notify(false);
+}
+
+// Create and push a work object that runs on a fiber and signals the fence signal if it isn't NULL.
+// Meant for work that waits on fences, such as a recursive fan out waiting on its children,
+// a wait yields the fiber rather than nesting other work on the thread's stack.
+void thread_pool_push_fiber(void (*funct)(void*), void* arg, struct thread_pool_fence* signal)
+{
+	struct work* const work = work_create(funct, arg);
+
+	if (!work)
+		return;
+
+	work->signal = signal;
+	work->fiber = true;
+
+	work_pending(work->scope, 1);
+
+	if (signal)
+		atomic_fetch_add(&signal->pending, 1);
+
+	thread_pool_push_work(work);
+	worker_notify(false);
+}
+
+// Push a work object to the background lane.
+// Background work runs on the worker threads only when there is no frame work,
+// within the per-frame budget, and isn't waited on by thread_pool_wait or the frame reset.
+// Unlike frame work it can span frames, so it's allocated from the heap along with its scope.
+void thread_pool_push_background(void (*funct)(void*), void* arg)
+{
+	if (!funct)
+		return;
+
+	struct background_scope* const scope = malloc(sizeof(struct background_scope));
+
+	if (!scope)
+		return;
+
+	struct work* const work = &scope->work;
+
+	*work = (struct work)
+	{
+		.funct = funct,
+		.arg = arg,
+		.next = NULL,
+		.signal = NULL,
+		.scope = scope,
+		.fiber = false
+	};
+
+	atomic_init(&work->unresolved, 0);
+
+	scope->arena = (struct arena){ 0 };
+	atomic_flag_clear(&scope->lock);
+	atomic_init(&scope->refs, 1);
+
+	al_lock_mutex(thread_pool.background_mutex);
+
+	if (thread_pool.background_last)
+		thread_pool.background_last->next = work;
+	else
+		thread_pool.background_first = work;
+
+	thread_pool.background_last = work;
+	atomic_fetch_add(&thread_pool.background_cnt, 1);
+
+	al_unlock_mutex(thread_pool.background_mutex);
+
+	worker_notify(false);
+}
+
+// Wait for all pushed work to complete.
+// The calling thread runs work while it waits instead of just sleeping.
+// Returns without taking any lock if the pool is already idle.
+void thread_pool_wait()
+{
+	if (pool_idle(NULL))
+		return;
+
+	struct worker* const worker = worker_current();
+
+	while (!pool_idle(NULL))
+	{
+		struct work* const work = worker_find_work(worker);
+
+		if (work)
+		{
+			STATS_TIME(start);
+			worker_execute(worker, work);
+			STATS_ADD_TIME(worker, busy_us, start);
+			STATS_ADD(worker, jobs, 1);
+			continue;
+		}
+
+		if (worker_spin(pool_idle, NULL))
+			continue;
+
+		latch_park(pool_idle, NULL);
+	}
+}
+
+// Concatenate a work queue on to the thread pool.
+// The queue is empty afterwards but, like the work objects, lives until the frame is reset.
+void thread_pool_concatenate(struct work_queue* queue)
+{
+	if (!queue)
+		return;
+
+	if (queue->first)
+	{
+		for (struct work* work = queue->first; work; work = work->next)
+			work_pending(work->scope, 1);
+
+		for (struct work* work = queue->first, *next; work; work = next)
+		{
+			next = work->next;
+			thread_pool_push_work(work);
+		}
+
+		worker_notify(true);
+	}
+
+	queue->first = NULL;
+	queue->last = NULL;
+}
+
+#ifdef THREAD_POOL_STATS
+// Print the utilization of each thread since the last dump, every STATS_PERIOD seconds.
+static void thread_pool_stats_dump()
+{
+	static double last_dump;
+	const double now = al_get_time();
+
+	if (last_dump == 0)
+		last_dump = now;
+
+	if (now - last_dump < STATS_PERIOD)
+		return;
+
+	const double period = now - last_dump;
+	last_dump = now;
+
+	printf("Thread Pool Stats (%.1lfs):\n", period);
+
+	for (size_t i = 0; i < thread_pool.worker_cnt; i++)
+	{
+		struct worker_stats* const stats = &thread_pool.workers[i].stats;
+		const unsigned long long busy_us = atomic_load_explicit(&stats->busy_us, memory_order_relaxed);
+		const unsigned long long idle_us = atomic_load_explicit(&stats->idle_us, memory_order_relaxed);
+
+		printf("\t%zu\tbusy %5.1lf%%\tidle %5.1lf%%\tjobs %llu\tsteals %llu\twaits %llu\n", i,
+			100 * 1e-6 * (busy_us - stats->last_busy_us) / period,
+			100 * 1e-6 * (idle_us - stats->last_idle_us) / period,
+			atomic_load_explicit(&stats->jobs, memory_order_relaxed),
+			atomic_load_explicit(&stats->steals, memory_order_relaxed),
+			atomic_load_explicit(&stats->waits, memory_order_relaxed));
+
+		stats->last_busy_us = busy_us;
+		stats->last_idle_us = idle_us;
+	}
+}
+
+// Lua: thread_pool_stats()
+// Returns an array with a table of running totals per thread, the main thread first.
+// depth[i] counts the submits made when the pushing deque held [2^(i-2), 2^(i-1)) work objects, depth[1] when it was empty.
+static int thread_pool_stats(lua_State* L)
+{
+	lua_createtable(L, (int)thread_pool.worker_cnt, 0);
+
+	for (size_t i = 0; i < thread_pool.worker_cnt; i++)
+	{
+		struct worker_stats* const stats = &thread_pool.workers[i].stats;
+
+		lua_createtable(L, 0, 7);
+
+		lua_pushnumber(L, 1e-6 * atomic_load_explicit(&stats->busy_us, memory_order_relaxed));
+		lua_setfield(L, -2, "busy");
+
+		lua_pushnumber(L, 1e-6 * atomic_load_explicit(&stats->idle_us, memory_order_relaxed));
+		lua_setfield(L, -2, "idle");
+
+		lua_pushnumber(L, 1e-6 * atomic_load_explicit(&stats->background_us, memory_order_relaxed));
+		lua_setfield(L, -2, "background");
+
+		lua_pushnumber(L, (lua_Number)atomic_load_explicit(&stats->jobs, memory_order_relaxed));
+		lua_setfield(L, -2, "jobs");
+
+		lua_pushnumber(L, (lua_Number)atomic_load_explicit(&stats->steals, memory_order_relaxed));
+		lua_setfield(L, -2, "steals");
+
+		lua_pushnumber(L, (lua_Number)atomic_load_explicit(&stats->waits, memory_order_relaxed));
+		lua_setfield(L, -2, "waits");
+
+		lua_createtable(L, STATS_DEPTH_BUCKETS, 0);
+
+		for (int j = 0; j < STATS_DEPTH_BUCKETS; j++)
+		{
+			lua_pushnumber(L, (lua_Number)atomic_load_explicit(stats->depth + j, memory_order_relaxed));
+			lua_rawseti(L, -2, j + 1);
+		}
+
+		lua_setfield(L, -2, "depth");
+
+		lua_rawseti(L, -2, (int)i + 1);
+	}
+
+	return 1;
+}
+#endif
+
+// Set the thread pool lua interface globals, there are none unless THREAD_POOL_STATS is defined.
+void lua_openL_thread_pool(lua_State* L)
+{
+#ifdef THREAD_POOL_STATS
+	lua_pushcfunction(L, thread_pool_stats);
+	lua_setglobal(L, "thread_pool_stats");
+#endif
+}
+
+// Reclaim the work objects and work queues of the frame and refill the background budget.
+// Must only be called by the main thread while the pool is idle, i.e. after thread_pool_wait.
+// Background work and what it pushes live in their scopes' arenas, so aren't waited for.
+void thread_pool_frame_reset()
+{
+	thread_pool_wait();
+
+	for (size_t i = 0; i < thread_pool.worker_cnt; i++)
+		arena_reset(&thread_pool.workers[i].arena);
+
+	atomic_store(&thread_pool.background_used_us, 0);
+
+	if (atomic_load(&thread_pool.background_cnt) != 0)
+		worker_notify(true);
+
+#ifdef THREAD_POOL_STATS
+	thread_pool_stats_dump();
+#endif
+}
+
+struct parallel_for_chunk
+{
+	void (*funct)(size_t, size_t, void*);
+	void* ctx;
+	size_t begin;
+	size_t end;
+};
+
+static void parallel_for_chunk_run(void* arg)
+{
+	const struct parallel_for_chunk* const chunk = (struct parallel_for_chunk*)arg;
+
+	chunk->funct(chunk->begin, chunk->end, chunk->ctx);
+}
+
+// Split [begin, end) into chunks of grain items and push a work object per chunk.
+// funct is called with the bounds of its chunk, a grain of 0 uses the pool default.
+// Each chunk signals fence if it isn't NULL. Doesn't wait for completion.
+void thread_pool_parallel_for(size_t begin, size_t end, size_t grain, void (*funct)(size_t, size_t, void*), void* ctx, struct thread_pool_fence* fence)
+{
+	if (!funct || begin >= end)
+		return;
+
+	if (grain == 0)
+		grain = thread_pool.grain;
+
+	const size_t cnt = (end - begin + grain - 1) / grain;
+	struct background_scope* const scope = scope_current();
+
+	work_pending(scope, cnt);
+
+	if (fence)
+		atomic_fetch_add(&fence->pending, cnt);
+
+	for (size_t i = begin; i < end; i += grain)
+	{
+		struct parallel_for_chunk* const chunk = thread_pool_alloc(sizeof(struct parallel_for_chunk));
+		struct work* const work = thread_pool_alloc(sizeof(struct work));
+
+		if (!chunk || !work)
+		{
+			funct(i, end - i > grain ? i + grain : end, ctx);
+
+			if (fence)
+				fence_signal(fence);
+
+			work_done(scope);
+			continue;
+		}
+
+		*chunk = (struct parallel_for_chunk)
+		{
+			.funct = funct,
+			.ctx = ctx,
+			.begin = i,
+			.end = end - i > grain ? i + grain : end
+		};
+
+		*work = (struct work)
+		{
+			.funct = parallel_for_chunk_run,
+			.arg = chunk,
+			.next = NULL,
+			.signal = fence,
+			.scope = scope,
+			.fiber = false
+		};
+
+		atomic_init(&work->unresolved, 0);
+
+		thread_pool_push_work(work);
+	}
+
+	worker_notify(true);
+}
+
+/*********************************************/
+/*                  Fences                   */
+/*********************************************/
+
+// A work object waiting on a fence.
+// Work can wait on several fences so each wait gets its own link.
+struct fence_link
+{
+	struct work* work;
+	struct fence_link* next;
+};
+
+// Marks a fence's waiter list as closed, work that finds it has nothing to wait for.
+static struct fence_link fence_closed;
+
+// Resolve one of a work object's dependencies, pushing it once they are all resolved.
+static void work_resolve(struct work* work)
+{
+	if (atomic_fetch_sub(&work->unresolved, 1) != 1)
+		return;
+
+	thread_pool_push_work(work);
+	worker_notify(false);
+}
+
+// A work object signalling the fence has run, complete the fence if it was the last one.
+static void fence_signal(struct thread_pool_fence* fence)
+{
+	if (atomic_fetch_sub(&fence->pending, 1) != 1)
+		return;
+
+	struct fence_link* link = atomic_exchange(&fence->waiters, &fence_closed);
+
+	for (; link; link = link->next)
+		work_resolve(link->work);
+
+	// Publishing completion is the last touch of the fence, a waiter may reuse or free it straight after.
+	atomic_store_explicit(&fence->done, true, memory_order_release);
+
+	latch_release();
+}
+
+// Prepare a fence, it stays open until sealed.
+void thread_pool_fence_init(struct thread_pool_fence* fence)
+{
+	atomic_init(&fence->pending, 1);
+	atomic_init(&fence->waiters, NULL);
+	atomic_init(&fence->done, false);
+}
+
+// No more work will signal the fence, it completes once the work already pushed has run.
+void thread_pool_fence_seal(struct thread_pool_fence* fence)
+{
+	fence_signal(fence);
+}
+
+bool thread_pool_fence_done(struct thread_pool_fence* fence)
+{
+	return atomic_load_explicit(&fence->done, memory_order_acquire);
+}
+
+static bool fence_done(void* fence)
+{
+	return thread_pool_fence_done((struct thread_pool_fence*)fence);
+}
+
+// Park a fiber on a fence, it's pushed to be resumed once the fence completes.
+// Returns false if the fence has already completed and the fiber should carry on.
+static bool fiber_park(struct fiber* fiber, struct thread_pool_fence* fence)
+{
+	struct work* const work = work_create(fiber_resume, fiber);
+	struct fence_link* const link = thread_pool_alloc(sizeof(struct fence_link));
+
+	// Out of memory, let the fiber check the fence and yield again.
+	if (!work || !link)
+		return false;
+
+	atomic_init(&work->unresolved, 1);
+	link->work = work;
+
+	struct fence_link* next = atomic_load(&fence->waiters);
+
+	do
+	{
+		if (next == &fence_closed)
+			return false;
+
+		link->next = next;
+	} while (!atomic_compare_exchange_weak(&fence->waiters, &next, link));
+
+	return true;
+}
+
+// Wait for the fence to complete.
+// Work running on a fiber yields, leaving its thread free for other work until the fence completes.
+// Otherwise the calling thread runs work while it waits instead of just sleeping.
+void thread_pool_fence_wait(struct thread_pool_fence* fence)
+{
+	struct worker* const worker = worker_current();
+
+	if (worker->fiber)
+	{
+		struct fiber* const fiber = worker->fiber;
+
+		while (!thread_pool_fence_done(fence))
+			fiber_yield(fiber, fence);
+
+		return;
+	}
+
+	while (!thread_pool_fence_done(fence))
+	{
+		struct work* const work = worker_find_work(worker);
+
+		if (work)
+		{
+			STATS_TIME(start);
+			worker_execute(worker, work);
+			STATS_ADD_TIME(worker, busy_us, start);
+			STATS_ADD(worker, jobs, 1);
+			continue;
+		}
+
+		if (worker_spin(fence_done, fence))
+			continue;
+
+		latch_park(fence_done, fence);
+	}
+}
+
+// Create and push a work object that runs once all of the dep_cnt fences in deps have completed.
+// The work signals the fence signal if it isn't NULL.
+void thread_pool_push_after(void (*funct)(void*), void* arg, struct thread_pool_fence* const* deps, size_t dep_cnt, struct thread_pool_fence* signal)
+{
+	struct work* const work = work_create(funct, arg);
+
+	if (!work)
+		return;
+
+	work->signal = signal;
+
+	// The extra dependency stops the work being pushed while its links are still being made.
+	atomic_init(&work->unresolved, dep_cnt + 1);
+
+	work_pending(work->scope, 1);
+
+	if (signal)
+		atomic_fetch_add(&signal->pending, 1);
+
+	for (size_t i = 0; i < dep_cnt; i++)
+	{
+		struct fence_link* const link = thread_pool_alloc(sizeof(struct fence_link));
+		struct fence_link* head = atomic_load(&deps[i]->waiters);
+
+		if (link)
+		{
+			link->work = work;
+
+			do
+			{
+				if (head == &fence_closed)
+					break;
+
+				link->next = head;
+			} while (!atomic_compare_exchange_weak(&deps[i]->waiters, &head, link));
+		}
+
+		// Already complete, or out of memory in which case waiting on the fence is the best we can do.
+		if (!link || head == &fence_closed)
+		{
+			if (!link)
+				thread_pool_fence_wait(deps[i]);
+
+			atomic_fetch_sub(&work->unresolved, 1);
+		}
+	}
+
+	work_resolve(work);
+}
+
+#ifdef THREAD_POOL_TESTING
+#define FAN_OUT_LEAF 1024
+
+// A node of a recursive sum, split in two until it's at most FAN_OUT_LEAF items.
+struct fan_out
+{
+	size_t begin;
+	size_t end;
+	size_t sum;
+};
+
+// Push each half as fiber work and wait on both, the wait yields so the thread can take the halves itself.
+static void fan_out_sum(void* arg)
+{
+	struct fan_out* const node = (struct fan_out*)arg;
+
+	if (node->end - node->begin <= FAN_OUT_LEAF)
+	{
+		for (size_t i = node->begin; i < node->end; i++)
+			node->sum += i;
+
+		return;
+	}
+
+	struct fan_out* const children = thread_pool_alloc(2 * sizeof(struct fan_out));
+	const size_t mid = node->begin + (node->end - node->begin) / 2;
+
+	if (!children)
+	{
+		fprintf(stderr, "failed to allocate fan out children!\n");
+		return;
+	}
+
+	children[0] = (struct fan_out){ .begin = node->begin, .end = mid };
+	children[1] = (struct fan_out){ .begin = mid, .end = node->end };
+
+	struct thread_pool_fence fence;
+	thread_pool_fence_init(&fence);
+
+	thread_pool_push_fiber(fan_out_sum, children, &fence);
+	thread_pool_push_fiber(fan_out_sum, children + 1, &fence);
+
+	thread_pool_fence_seal(&fence);
+	thread_pool_fence_wait(&fence);
+
+	node->sum = children[0].sum + children[1].sum;
+}
+
+// Sum [0, 2^16) with a recursive fan out, exercising fiber work yielding on and resuming from fences.
+static void thread_pool_test()
+{
+	struct fan_out root = { .begin = 0, .end = (size_t)1 << 16 };
+	struct thread_pool_fence fence;
+
+	thread_pool_fence_init(&fence);
+	thread_pool_push_fiber(fan_out_sum, &root, &fence);
+	thread_pool_fence_seal(&fence);
+	thread_pool_fence_wait(&fence);
+
+	const size_t expected = root.end * (root.end - 1) / 2;
+
+	printf("Thread pool fan out sum %zu, expected %zu: %s\n", root.sum, expected, root.sum == expected ? "ok" : "FAILED");
+}
+#endif
@@ -2,18 +2,57 @@
 // Use of this source code is governed by an MIT-style
 // license that can be found in the LICENSE file.
 
-// TODO: Add some type of batching of work based on how much work there is to do to people to do it
-
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+
 struct work_queue;
 
+struct thread_pool_config
+{
+	int thread_cnt;		// Number of worker threads, 0 or less sizes the pool from the online cpus
+	int grain;			// Default number of items per parallel for chunk
+	int spin_us;		// Microseconds an idle thread spins looking for work before sleeping
+	bool affinity;		// Pin each worker thread to its own cpu
+	int background_budget_us;	// Microseconds of background work run per frame, 0 or less is unlimited
+};
+
+// A fence counts the work objects that signal it and completes once they have all run.
+// Work can be made to depend on fences, and callers can wait on a single fence rather than the whole pool.
+// Fences are owned by the caller: init, push work that signals it, then seal.
+struct thread_pool_fence
+{
+	atomic_size_t pending;
+	_Atomic(struct fence_link*) waiters;
+	atomic_bool done;		// Set once pending hit zero and the waiters were released
+};
+
 struct work_queue* work_queue_create();
 void work_queue_push(struct work_queue*, void(*)(void*), void*);
 void work_queue_concatenate(struct work_queue*, struct work_queue*);
 void work_queue_destroy(struct work_queue*);
 void work_queue_run(struct work_queue*);
 
+// Only the main thread and the pool's own threads may push frame work, use fences or wait.
 void thread_pool_push(void (*)(void*), void*);
+
+// Like thread_pool_push but the work runs on a fiber and signals the fence if it isn't NULL.
+// Use it for work that waits on fences, a wait on a fiber yields instead of running other work on top of it.
+void thread_pool_push_fiber(void (*)(void*), void*, struct thread_pool_fence*);
+
+// Any thread may push background work.
+// Background work may push work, wait on fences or run a parallel for like frame work does.
+// What it pushes is allocated in its own arena, freed once all of it has finished, and neither
+// thread_pool_wait nor thread_pool_frame_reset wait for it.
+void thread_pool_push_background(void (*)(void*), void*);
 void thread_pool_concatenate(struct work_queue*);
 void thread_pool_wait();
+void thread_pool_parallel_for(size_t, size_t, size_t, void (*)(size_t, size_t, void*), void*, struct thread_pool_fence*);
+void thread_pool_push_after(void (*)(void*), void*, struct thread_pool_fence* const*, size_t, struct thread_pool_fence*);
+
+void thread_pool_fence_init(struct thread_pool_fence*);
+void thread_pool_fence_seal(struct thread_pool_fence*);
+void thread_pool_fence_wait(struct thread_pool_fence*);
+bool thread_pool_fence_done(struct thread_pool_fence*);
@@ -64,6 +64,11 @@ static void mask(const struct wg_base* const wg)
 		0);
 }
 
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	return wg_hit_bitmap(wg, resource_manager_tile(TILE_EMPTY), 300, 300, x, y);
+}
+
 static int index(lua_State* L)
 {
 	struct tile* const tile = (struct tile* const) check_widget_lua(-2, &tile_jumptable);
@@ -147,6 +152,7 @@ const struct wg_jumptable_zone tile_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 
 	.index = index,
 	.newindex = newindex
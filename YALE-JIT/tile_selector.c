@@ -116,6 +116,51 @@ static void mask(const struct wg_base* const wg)
 		x += draw_tile(selector, x, selector->hover + 1, (selector->r > 0.5) ? (selector->r - 0.5) : 0);
 }
 
+// Width draw_tile gives a tile blended r of the way to large.
+static inline double tile_width(const struct tile_selector* selector, double r)
+{
+	r = r * r * (3.0 - 2.0 * r);
+
+	return 2 * (selector->small + r * (selector->large - selector->small));
+}
+
+// Matches the mask, the bar plus the three tiles around the hover laid out the same way.
+static bool hit(const struct wg_base* const wg, double x, double y)
+{
+	const struct tile_selector* const selector = (const struct tile_selector* const)wg;
+
+	if (wg_hit_rounded_box(wg->hw, selector->small, selector->pallet->edge_radius, x, y))
+		return true;
+
+	double blends[3];
+	int cnt = 0;
+
+	if (selector->hover > 0)
+		blends[cnt++] = (selector->r < 0.5) ? (0.5 - selector->r) : 0;
+
+	if ((selector->hover == 0 && selector->r < 0.5) || (selector->hover == TILE_CNT - 1 && selector->r > 0.5))
+		blends[cnt++] = 1;
+	else
+		blends[cnt++] = (selector->r < 0.5) ? (selector->r + 0.5) : (1.5 - selector->r);
+
+	if (selector->hover + 1 < TILE_CNT)
+		blends[cnt++] = (selector->r > 0.5) ? (selector->r - 0.5) : 0;
+
+	double left = -wg->hw + 2 * selector->small * (selector->hover - 1);
+
+	for (int i = 0; i < cnt; i++)
+	{
+		const double width = tile_width(selector, blends[i]);
+
+		if (x >= left && x <= left + width && fabs(y) <= 0.5 * width)
+			return true;
+
+		left += width;
+	}
+
+	return false;
+}
+
 static void left_held(struct wg_base* const wg)
 {
 	struct tile_selector* const selector = (const struct tile_selector* const)wg;
@@ -219,6 +264,7 @@ const struct wg_jumptable_hud tile_selector_jumptable =
 
 	.draw = draw,
 	.mask = mask,
+	.hit = hit,
 
 	.left_held = left_held,
 
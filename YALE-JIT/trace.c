@@ -0,0 +1,261 @@
+// Copyright 2024 Kieran W Harvie. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+
+#include "trace.h"
+
+#include <allegro5/allegro.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+
+// Events per chunk, a thread allocates a new chunk when its current one fills.
+#define TRACE_CHUNK_SIZE 4096
+
+struct trace_event
+{
+	const char* name;
+	const char* detail;
+	const void* address;
+	double begin;
+	double end;
+};
+
+// Written only by the owning thread, cnt and next are published so trace_flush can read behind it.
+struct trace_chunk
+{
+	struct trace_event events[TRACE_CHUNK_SIZE];
+	atomic_size_t cnt;
+	struct trace_chunk* _Atomic next;
+};
+
+struct trace_buffer
+{
+	// Owned by the thread recording
+	struct trace_chunk* tail;
+
+	// Owned by trace_flush, the oldest chunk not yet freed and how much of it has been written
+	struct trace_chunk* head;
+	size_t flushed;
+
+	struct trace_buffer* next;
+	int tid;
+	char name[32];
+};
+
+bool trace_enabled;
+
+static FILE* trace_file;
+static double trace_start;
+static bool trace_empty;
+
+// Every thread that has recorded, buffers are never freed since their thread may still hold them.
+static struct trace_buffer* _Atomic trace_buffers;
+static atomic_int trace_buffer_cnt;
+static _Thread_local struct trace_buffer* thread_buffer;
+
+static struct trace_buffer* trace_register()
+{
+	struct trace_buffer* const buffer = calloc(1, sizeof(struct trace_buffer));
+
+	if (!buffer)
+		return NULL;
+
+	buffer->tail = calloc(1, sizeof(struct trace_chunk));
+
+	if (!buffer->tail)
+	{
+		free(buffer);
+		return NULL;
+	}
+
+	buffer->head = buffer->tail;
+	buffer->tid = atomic_fetch_add(&trace_buffer_cnt, 1) + 1;
+
+	struct trace_buffer* first = atomic_load(&trace_buffers);
+
+	do
+		buffer->next = first;
+	while (!atomic_compare_exchange_weak(&trace_buffers, &first, buffer));
+
+	thread_buffer = buffer;
+
+	return buffer;
+}
+
+double trace_timestamp()
+{
+	return al_get_time();
+}
+
+// Record a span from begin until now on the calling thread.
+// Strings are stored by pointer so must outlive the trace, literals and jumptable types do.
+void trace_span(const char* name, const char* detail, const void* address, double begin)
+{
+	struct trace_buffer* const buffer = thread_buffer ? thread_buffer : trace_register();
+
+	if (!buffer)
+		return;
+
+	struct trace_chunk* chunk = buffer->tail;
+	size_t cnt = atomic_load_explicit(&chunk->cnt, memory_order_relaxed);
+
+	if (cnt == TRACE_CHUNK_SIZE)
+	{
+		struct trace_chunk* const next = calloc(1, sizeof(struct trace_chunk));
+
+		// Drop the event rather than stall the thread.
+		if (!next)
+			return;
+
+		atomic_store_explicit(&chunk->next, next, memory_order_release);
+
+		buffer->tail = chunk = next;
+		cnt = 0;
+	}
+
+	chunk->events[cnt] = (struct trace_event){
+		.name = name,
+		.detail = detail,
+		.address = address,
+		.begin = begin,
+		.end = al_get_time()
+	};
+
+	atomic_store_explicit(&chunk->cnt, cnt + 1, memory_order_release);
+}
+
+// Name the calling thread in the trace, e.g. "worker" 3, a negative index is left off.
+void trace_thread_name(const char* name, int index)
+{
+	if (!trace_enabled)
+		return;
+
+	struct trace_buffer* const buffer = thread_buffer ? thread_buffer : trace_register();
+
+	if (buffer && index < 0)
+		snprintf(buffer->name, sizeof(buffer->name), "%s", name);
+	else if (buffer)
+		snprintf(buffer->name, sizeof(buffer->name), "%s %d", name, index);
+}
+
+static void trace_write(const struct trace_buffer* buffer, const struct trace_event* event)
+{
+	fprintf(trace_file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+		trace_empty ? "" : ",",
+		event->name, buffer->tid,
+		1e6 * (event->begin - trace_start), 1e6 * (event->end - event->begin));
+
+	if (event->detail || event->address)
+	{
+		fprintf(trace_file, ",\"args\":{");
+
+		if (event->detail)
+			fprintf(trace_file, "\"detail\":\"%s\"%s", event->detail, event->address ? "," : "");
+
+		if (event->address)
+			fprintf(trace_file, "\"address\":\"%p\"", event->address);
+
+		fprintf(trace_file, "}");
+	}
+
+	fprintf(trace_file, "}");
+
+	trace_empty = false;
+}
+
+// Write every event recorded since the last flush and free the chunks that are done with.
+// Only call from one thread at a time, recording threads don't need to stop.
+void trace_flush()
+{
+	if (!trace_file)
+		return;
+
+	for (struct trace_buffer* buffer = atomic_load(&trace_buffers); buffer; buffer = buffer->next)
+		while (true)
+		{
+			struct trace_chunk* const chunk = buffer->head;
+
+			// The recording thread has moved on from a chunk once it publishes the next one,
+			// so load next first, if it's set the count read after it is final.
+			struct trace_chunk* const next = atomic_load_explicit(&chunk->next, memory_order_acquire);
+			const size_t cnt = atomic_load_explicit(&chunk->cnt, memory_order_acquire);
+
+			for (size_t i = buffer->flushed; i < cnt; i++)
+				trace_write(buffer, chunk->events + i);
+
+			buffer->flushed = cnt;
+
+			if (!next)
+				break;
+
+			buffer->head = next;
+			buffer->flushed = 0;
+
+			free(chunk);
+		}
+
+	fflush(trace_file);
+}
+
+// Lua: trace_flush() writes what has been recorded so far.
+static int lua_trace_flush(lua_State* L)
+{
+	trace_flush();
+
+	return 0;
+}
+
+void lua_openL_trace(lua_State* L)
+{
+	lua_pushcfunction(L, lua_trace_flush);
+	lua_setglobal(L, "trace_flush");
+}
+
+// Start tracing to the given file, NULL leaves tracing off.
+void trace_init(const char* file_name)
+{
+	if (!file_name)
+		return;
+
+	if (fopen_s(&trace_file, file_name, "w") != 0 || !trace_file)
+	{
+		fprintf(stderr, "failed to open trace file %s\n", file_name);
+		trace_file = NULL;
+		return;
+	}
+
+	fprintf(trace_file, "[");
+
+	trace_start = al_get_time();
+	trace_empty = true;
+	trace_enabled = true;
+}
+
+// Stop recording, write the remaining events and thread names, and close the file.
+void trace_close()
+{
+	if (!trace_file)
+		return;
+
+	trace_enabled = false;
+	trace_flush();
+
+	for (struct trace_buffer* buffer = atomic_load(&trace_buffers); buffer; buffer = buffer->next)
+		if (buffer->name[0])
+		{
+			fprintf(trace_file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+				trace_empty ? "" : ",", buffer->tid, buffer->name);
+
+			trace_empty = false;
+		}
+
+	fprintf(trace_file, "\n]\n");
+	fclose(trace_file);
+
+	trace_file = NULL;
+}
@@ -0,0 +1,21 @@
+// Copyright 2024 Kieran W Harvie. All rights reserved.
+// Use of this source code is governed by an MIT-style
+// license that can be found in the LICENSE file.
+#pragma once
+
+#include <stdbool.h>
+
+// Chrome trace event spans, viewable in chrome://tracing or Perfetto.
+// Only enabled when trace_init opens a file, the macros cost a branch otherwise.
+extern bool trace_enabled;
+
+#define TRACE_BEGIN(begin) const double begin = trace_enabled ? trace_timestamp() : 0
+#define TRACE_END(begin, name, detail, address) if (trace_enabled) trace_span((name), (detail), (address), (begin))
+
+void trace_init(const char*);
+void trace_close();
+void trace_flush();
+
+void trace_thread_name(const char*, int);
+double trace_timestamp();
+void trace_span(const char*, const char*, const void*, double);
@@ -8,6 +8,7 @@
 #include "thread_pool.h"
 #include "material.h"
 #include "resource_manager.h"
+#include "trace.h"
 
 #include <allegro5/allegro.h>
 #include <allegro5/allegro_font.h>
@@ -20,6 +21,7 @@
 #include <luajit.h>
 
 #include <stdio.h>
+#include <stddef.h>
 #include <float.h>
 #include <math.h>
 
@@ -27,7 +29,10 @@
 extern double mouse_x;
 extern double mouse_y;
 extern double current_timestamp;
+extern double future_timestamp;
 extern double delta_timestamp;
+extern double residual_timestamp;
+extern double step_timestamp;
 extern ALLEGRO_EVENT current_event;
 extern const ALLEGRO_TRANSFORM identity_transform;
 extern void invert_transform_3D(ALLEGRO_TRANSFORM*);
@@ -85,6 +90,19 @@ struct wg_header
         };
 		struct wg_internal* parent;
     };
+
+    // Bytes allocated for the widget, for copying it into a render snapshot.
+    size_t size;
+
+    // Where the Bzier control points are kept in bezier_store.
+    size_t slot;
+
+    // Color the offscreen pass draws the widget's mask in, see pick_ids.
+    size_t pick_id;
+
+    // Fixed timestep: geometry at the start of the last step, valid while last_timestamp is current_timestamp.
+    struct geometry last_geometry;
+    double last_timestamp;
 };
 
 struct wg_internal
@@ -141,6 +159,10 @@ static struct geometry* wg_geometry(struct wg_internal* wg)
 /*              Widgets Untility             */
 /*********************************************/
 
+// Bumped whenever something a pick depends on may have changed:
+// widget geometry, the camera, the widget tree, or a callback or event that could change a mask.
+static size_t scene_version;
+
 static bool wg_is_branch(struct wg_internal* wg)
 {
 	return (wg->type == WG_ZONE || wg->type == WG_FRAME);
@@ -163,6 +185,8 @@ static bool wg_is_hud(struct wg_internal* wg)
 
 static void wg_append(struct wg_internal* branch, struct wg_internal* leaf)
 {
+    scene_version++;
+
     if (branch->tail)
         branch->tail->next = leaf;
     else
@@ -178,6 +202,8 @@ static void wg_remove(struct wg_internal* const leaf)
 {
 	struct wg_internal* parent = leaf->parent;
 
+	scene_version++;
+
 	if (leaf->next)
 		leaf->next->previous = leaf->previous;
 	else if (parent && parent->tail == leaf)
@@ -320,6 +346,143 @@ void lua_cleangeometry(int idx)
     lua_setfield(lua_state, idx - 1, "hw");
 }
 
+/*********************************************/
+/*                 Hit Tests                 */
+/*********************************************/
+
+// Exact hit tests for the jumptable hit method, x and y are in the widget's own coordinates,
+// the same ones mask draws in. A hit test must stay within the widget's half-width and half-height.
+
+bool wg_hit_rectangle(const struct wg_base* const wg, double x, double y)
+{
+    return fabs(x) <= fabs(wg->hw) && fabs(y) <= fabs(wg->hh);
+}
+
+bool wg_hit_rounded_rectangle(const struct wg_base* const wg, double radius, double x, double y)
+{
+    return wg_hit_rounded_box(wg->hw, wg->hh, radius, x, y);
+}
+
+// Rounded rectangle of half width hw and half height hh centered on the origin.
+bool wg_hit_rounded_box(double hw, double hh, double radius, double x, double y)
+{
+    hw = fabs(hw);
+    hh = fabs(hh);
+
+    x = fabs(x);
+    y = fabs(y);
+
+    if (x > hw || y > hh)
+        return false;
+
+    radius = fmin(radius, fmin(hw, hh));
+
+    // Only the corners are rounded.
+    const double cx = x - (hw - radius);
+    const double cy = y - (hh - radius);
+
+    return cx <= 0 || cy <= 0 || cx * cx + cy * cy <= radius * radius;
+}
+
+bool wg_hit_ellipse(const struct wg_base* const wg, double x, double y)
+{
+    if (wg->hw == 0 || wg->hh == 0)
+        return false;
+
+    x /= wg->hw;
+    y /= wg->hh;
+
+    return x * x + y * y <= 1;
+}
+
+// Alpha of each bitmap used in a hit test, read back once on first use.
+struct alpha_mask
+{
+    ALLEGRO_BITMAP* bitmap;
+    int width, height;
+    unsigned char* alpha;
+};
+
+static struct alpha_mask* alpha_masks;
+static size_t alpha_masks_allocated;
+static size_t alpha_mask_cnt;
+
+static const struct alpha_mask* alpha_mask_get(ALLEGRO_BITMAP* bitmap)
+{
+    for (size_t i = 0; i < alpha_mask_cnt; i++)
+        if (alpha_masks[i].bitmap == bitmap)
+            return alpha_masks + i;
+
+    if (alpha_mask_cnt == alpha_masks_allocated)
+    {
+        const size_t new_cnt = 2 * alpha_masks_allocated + 8;
+        struct alpha_mask* const memsafe_hande = realloc(alpha_masks, new_cnt * sizeof(struct alpha_mask));
+
+        if (!memsafe_hande)
+            return NULL;
+
+        alpha_masks = memsafe_hande;
+        alpha_masks_allocated = new_cnt;
+    }
+
+    const int width = al_get_bitmap_width(bitmap);
+    const int height = al_get_bitmap_height(bitmap);
+
+    unsigned char* const alpha = malloc((size_t)width * height);
+
+    if (!alpha)
+        return NULL;
+
+    // ABGR little endian is RGBA in memory.
+    ALLEGRO_LOCKED_REGION* const region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888_LE, ALLEGRO_LOCK_READONLY);
+
+    if (!region)
+    {
+        free(alpha);
+        return NULL;
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        const unsigned char* const row = (const unsigned char*)region->data + (ptrdiff_t)y * region->pitch;
+
+        for (int x = 0; x < width; x++)
+            alpha[(size_t)y * width + x] = row[4 * x + 3];
+    }
+
+    al_unlock_bitmap(bitmap);
+
+    alpha_masks[alpha_mask_cnt] = (struct alpha_mask){
+        .bitmap = bitmap,
+        .width = width,
+        .height = height,
+        .alpha = alpha
+    };
+
+    return alpha_masks + alpha_mask_cnt++;
+}
+
+// The region (0, 0, sw, sh) of bitmap stretched over the widget, as mask draws it, hit where alpha isn't 0.
+bool wg_hit_bitmap(const struct wg_base* const wg, ALLEGRO_BITMAP* bitmap, double sw, double sh, double x, double y)
+{
+    if (!wg_hit_rectangle(wg, x, y))
+        return false;
+
+    const struct alpha_mask* const mask = bitmap ? alpha_mask_get(bitmap) : NULL;
+
+    // Without the alpha fall back to the box.
+    if (!mask)
+        return true;
+
+    const int u = (int)((x + wg->hw) / (2 * wg->hw) * sw);
+    const int v = (int)((y + wg->hh) / (2 * wg->hh) * sh);
+
+    if (u < 0 || v < 0 || u >= mask->width || v >= mask->height)
+        return false;
+
+    return mask->alpha[(size_t)v * mask->width + u] != 0;
+}
+
 /*********************************************/
 /*                  Bzier                   */
 /*********************************************/
@@ -327,83 +490,368 @@ void lua_cleangeometry(int idx)
 // The widget wg is controled through a standard 
 //  Cubic Bzier Curve with the following points:
 // P0: &wg_keyframe(wg)
-// P1: wg->ctrl1
-// P2: wg->ctrl2
-// P3: wg->dest
+// P1: bezier_store.point[BEZIER_CTRL1][field][wg->slot]
+// P2: bezier_store.point[BEZIER_CTRL2][field][wg->slot]
+// P3: bezier_store.point[BEZIER_DEST][field][wg->slot]
+// Ending at bezier_store.t[wg->slot]
+
+// P1 to P3 live in an engine owned store with one contiguous array per geometry field,
+// so the tweener walks memory linearly and evaluates several widgets per instruction.
+// P0 stays in the widget since drawing and lua read the geometry in place.
+// Slot 0 is the camera's, it is tweened on its own.
+// Slots [1, active) are animating, a slot joins when given a future end and leaves once it has reached it,
+// so the tweener only ever walks the widgets that are moving.
+
+#define BEZIER_FIELDS (sizeof(struct geometry) / sizeof(double))
+#define BEZIER_FIELD_C (offsetof(struct geometry, c) / sizeof(double))
+
+enum bezier_point
+{
+    BEZIER_CTRL1,
+    BEZIER_CTRL2,
+    BEZIER_DEST,
+    BEZIER_POINTS
+};
+
+static struct
+{
+    double* point[BEZIER_POINTS][BEZIER_FIELDS];
+    double* t;
+    struct wg_internal** owner;
+
+    // All of point and t share one block, allocated slots apiece.
+    double* block;
+    size_t active;
+    size_t cnt;
+    size_t allocated;
+} bezier_store = { .active = 1 };
+
+static bool bezier_store_grow()
+{
+    const size_t new_cnt = 2 * bezier_store.allocated + 64;
+    const size_t arrays = BEZIER_POINTS * BEZIER_FIELDS + 1;
+
+    double* const block = malloc(arrays * new_cnt * sizeof(double));
+
+    if (!block)
+        return false;
+
+    struct wg_internal** const owner = realloc(bezier_store.owner, new_cnt * sizeof(struct wg_internal*));
+
+    if (!owner)
+    {
+        free(block);
+        return false;
+    }
+
+    for (size_t i = 0; i < arrays; i++)
+        if (bezier_store.block)
+            memcpy_s(block + i * new_cnt, new_cnt * sizeof(double),
+                bezier_store.block + i * bezier_store.allocated, bezier_store.cnt * sizeof(double));
+
+    free(bezier_store.block);
+
+    for (size_t point = 0; point < BEZIER_POINTS; point++)
+        for (size_t field = 0; field < BEZIER_FIELDS; field++)
+            bezier_store.point[point][field] = block + (point * BEZIER_FIELDS + field) * new_cnt;
+
+    bezier_store.t = block + BEZIER_POINTS * BEZIER_FIELDS * new_cnt;
+    bezier_store.owner = owner;
+    bezier_store.block = block;
+    bezier_store.allocated = new_cnt;
+
+    return true;
+}
+
+// Give the widget the next free slot, only from the main thread and not while the tweener runs.
+static bool bezier_alloc(struct wg_internal* wg)
+{
+    if (bezier_store.cnt == bezier_store.allocated && !bezier_store_grow())
+        return false;
+
+    wg->slot = bezier_store.cnt++;
+    bezier_store.owner[wg->slot] = wg;
+
+    return true;
+}
+
+// Exchange two slots, updating their owners.
+static void bezier_swap(size_t a, size_t b)
+{
+    if (a == b)
+        return;
+
+    for (size_t point = 0; point < BEZIER_POINTS; point++)
+        for (size_t field = 0; field < BEZIER_FIELDS; field++)
+        {
+            double* const values = bezier_store.point[point][field];
+            const double buffer = values[a];
+            values[a] = values[b];
+            values[b] = buffer;
+        }
+
+    const double t = bezier_store.t[a];
+    bezier_store.t[a] = bezier_store.t[b];
+    bezier_store.t[b] = t;
+
+    struct wg_internal* const owner = bezier_store.owner[a];
+    bezier_store.owner[a] = bezier_store.owner[b];
+    bezier_store.owner[b] = owner;
+
+    bezier_store.owner[a]->slot = a;
+    bezier_store.owner[b]->slot = b;
+}
+
+// Move the freed slot to the end, out of the animating slots first, to keep the store packed.
+static void bezier_free(size_t slot)
+{
+    if (slot < bezier_store.active)
+    {
+        bezier_swap(slot, --bezier_store.active);
+        slot = bezier_store.active;
+    }
+
+    bezier_swap(slot, --bezier_store.cnt);
+}
+
+static void wg_bezier_get(const struct wg_internal* wg, enum bezier_point point, struct geometry* geometry)
+{
+    double* const values = (double*)geometry;
+
+    for (size_t field = 0; field < BEZIER_FIELDS; field++)
+        values[field] = bezier_store.point[point][field][wg->slot];
+}
+
+static void wg_bezier_put(const struct wg_internal* wg, enum bezier_point point, const struct geometry* geometry)
+{
+    const double* const values = (const double*)geometry;
+
+    for (size_t field = 0; field < BEZIER_FIELDS; field++)
+        bezier_store.point[point][field][wg->slot] = values[field];
+}
+
+static inline double* wg_bezier_t(const struct wg_internal* wg)
+{
+    return bezier_store.t + wg->slot;
+}
+
+// Set when the widget's curve ends, a future end joins the animating slots.
+// Only from the main thread and not while the tweener runs.
+static void wg_bezier_until(struct wg_internal* wg, double t)
+{
+    *wg_bezier_t(wg) = t;
+
+    if (t >= current_timestamp && wg->slot >= bezier_store.active)
+        bezier_swap(wg->slot, bezier_store.active++);
+}
 
 static void wg_bezier_set(struct wg_internal* wg, struct geometry* geometry)
 {
 	geometry_copy(wg_geometry(wg), geometry);
-	geometry_copy(&wg->ctrl1, geometry);
-	geometry_copy(&wg->ctrl2, geometry);
-	geometry_copy(&wg->dest, geometry);
+	wg_bezier_put(wg, BEZIER_CTRL1, geometry);
+	wg_bezier_put(wg, BEZIER_CTRL2, geometry);
+	wg_bezier_put(wg, BEZIER_DEST, geometry);
+
+    *wg_bezier_t(wg) = current_timestamp;
 
-    wg->t = current_timestamp;
+    scene_version++;
 }
 
 static void wg_bezier_parameter(struct wg_internal* wg, size_t offset, double values[4])
 {
-    double* bezier[4] = {
-        ((double*) wg_geometry(wg))+ offset,
-        ((double*) &wg->ctrl1) + offset,
-        ((double*) &wg->ctrl2) + offset,
-        ((double*) &wg->dest) + offset
-    };
+    ((double*)wg_geometry(wg))[offset] = values[0];
+    scene_version++;
 
-    *bezier[0] = values[0];
-    *bezier[1] = values[1];
-    *bezier[2] = values[2];
-    *bezier[3] = values[3]; 
+    for (size_t point = 0; point < BEZIER_POINTS; point++)
+        bezier_store.point[point][offset][wg->slot] = values[point + 1];
 }
 
-static void wg_bezier_update(struct wg_internal* wg)
+// Split the curve of one slot at delta_timestamp keeping the second half, de Casteljau's algorithm.
+// Reaching the end snaps to the destination, c included, otherwise c isn't tweened.
+static void bezier_update_slot(size_t slot)
 {
-    const double dt = wg->t - current_timestamp;
+    const double dt = bezier_store.t[slot] - current_timestamp;
 
     if (dt < 0.0)
         return;
 
-    if (delta_timestamp >= dt)
+    const bool snap = delta_timestamp >= dt;
+
+    // Warning: Standard numeric stability concerns.
+    const double blend = snap ? 1 : delta_timestamp / dt;
+
+    double* const p0 = (double*)wg_geometry(bezier_store.owner[slot]);
+
+    for (size_t field = 0; field < BEZIER_FIELDS; field++)
     {
-        wg_bezier_set(wg, &wg->dest);
+        const double b = (field != BEZIER_FIELD_C || snap) ? blend : 0;
+        const double p1 = bezier_store.point[BEZIER_CTRL1][field][slot];
+        const double p2 = bezier_store.point[BEZIER_CTRL2][field][slot];
+        const double p3 = bezier_store.point[BEZIER_DEST][field][slot];
+
+        const double q0 = p1 * b + p0[field] * (1 - b);
+        const double q1 = p2 * b + p1 * (1 - b);
+        const double q2 = p3 * b + p2 * (1 - b);
+
+        const double r0 = q1 * b + q0 * (1 - b);
+        const double r1 = q2 * b + q1 * (1 - b);
+
+        p0[field] = r1 * b + r0 * (1 - b);
+        bezier_store.point[BEZIER_CTRL1][field][slot] = r1;
+        bezier_store.point[BEZIER_CTRL2][field][slot] = q2;
+    }
+
+    if (snap)
+        bezier_store.t[slot] = current_timestamp;
+}
+
+static void wg_bezier_update(struct wg_internal* wg)
+{
+    bezier_update_slot(wg->slot);
+}
+
+// Packed lanes of slots, AVX when built for it and SSE2 on any x64.
+// Only what's in both is used, no FMA or blendv, so every path gives the scalar results.
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BEZIER_LANES 4
+typedef __m256d bezier_vec;
+#define bv_load _mm256_loadu_pd
+#define bv_store _mm256_storeu_pd
+#define bv_set1 _mm256_set1_pd
+#define bv_add _mm256_add_pd
+#define bv_sub _mm256_sub_pd
+#define bv_mul _mm256_mul_pd
+#define bv_div _mm256_div_pd
+#define bv_and _mm256_and_pd
+#define bv_andnot _mm256_andnot_pd
+#define bv_or _mm256_or_pd
+#define bv_lt(a, b) _mm256_cmp_pd(a, b, _CMP_LT_OQ)
+#define bv_ge(a, b) _mm256_cmp_pd(a, b, _CMP_GE_OQ)
+#define bv_movemask _mm256_movemask_pd
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BEZIER_LANES 2
+typedef __m128d bezier_vec;
+#define bv_load _mm_loadu_pd
+#define bv_store _mm_storeu_pd
+#define bv_set1 _mm_set1_pd
+#define bv_add _mm_add_pd
+#define bv_sub _mm_sub_pd
+#define bv_mul _mm_mul_pd
+#define bv_div _mm_div_pd
+#define bv_and _mm_and_pd
+#define bv_andnot _mm_andnot_pd
+#define bv_or _mm_or_pd
+#define bv_lt _mm_cmplt_pd
+#define bv_ge _mm_cmpge_pd
+#define bv_movemask _mm_movemask_pd
+#endif
+
+#ifdef BEZIER_LANES
+// mask ? b : a, lane by lane
+#define bv_select(mask, a, b) bv_or(bv_and(mask, b), bv_andnot(mask, a))
+#define bv_lerp(from, to, blend, still) bv_add(bv_mul(to, blend), bv_mul(from, still))
+
+// bezier_update_slot over BEZIER_LANES slots from slot, P0 is gathered from and scattered back to the owners.
+static void bezier_update_lanes(size_t slot)
+{
+    const bezier_vec zero = bv_set1(0);
+    const bezier_vec one = bv_set1(1);
+    const bezier_vec delta = bv_set1(delta_timestamp);
+
+    const bezier_vec t = bv_load(bezier_store.t + slot);
+    const bezier_vec dt = bv_sub(t, bv_set1(current_timestamp));
+    const bezier_vec moving = bv_ge(dt, zero);
+
+    if (!bv_movemask(moving))
         return;
+
+    const bezier_vec snap = bv_and(moving, bv_ge(delta, dt));
+
+    // Lanes not moving get a blend of 0, which leaves them as they are.
+    bezier_vec blend = bv_select(snap, bv_div(delta, dt), one);
+    blend = bv_and(moving, blend);
+
+    const bezier_vec still = bv_sub(one, blend);
+    const bezier_vec snap_blend = bv_and(snap, one);
+    const bezier_vec snap_still = bv_sub(one, snap_blend);
+
+    double* p0[BEZIER_LANES];
+
+    for (size_t lane = 0; lane < BEZIER_LANES; lane++)
+        p0[lane] = (double*)wg_geometry(bezier_store.owner[slot + lane]);
+
+    for (size_t field = 0; field < BEZIER_FIELDS; field++)
+    {
+        const bezier_vec b = field != BEZIER_FIELD_C ? blend : snap_blend;
+        const bezier_vec nb = field != BEZIER_FIELD_C ? still : snap_still;
+
+        double* const ctrl1 = bezier_store.point[BEZIER_CTRL1][field] + slot;
+        double* const ctrl2 = bezier_store.point[BEZIER_CTRL2][field] + slot;
+        double lanes[BEZIER_LANES];
+
+        for (size_t lane = 0; lane < BEZIER_LANES; lane++)
+            lanes[lane] = p0[lane][field];
+
+        const bezier_vec a0 = bv_load(lanes);
+        const bezier_vec a1 = bv_load(ctrl1);
+        const bezier_vec a2 = bv_load(ctrl2);
+        const bezier_vec a3 = bv_load(bezier_store.point[BEZIER_DEST][field] + slot);
+
+        const bezier_vec q0 = bv_lerp(a0, a1, b, nb);
+        const bezier_vec q1 = bv_lerp(a1, a2, b, nb);
+        const bezier_vec q2 = bv_lerp(a2, a3, b, nb);
+
+        const bezier_vec r0 = bv_lerp(q0, q1, b, nb);
+        const bezier_vec r1 = bv_lerp(q1, q2, b, nb);
+
+        bv_store(lanes, bv_lerp(r0, r1, b, nb));
+        bv_store(ctrl1, r1);
+        bv_store(ctrl2, q2);
+
+        for (size_t lane = 0; lane < BEZIER_LANES; lane++)
+            p0[lane][field] = lanes[lane];
     }
 
-    // Warning: Standard numeric stability concerns.
-    double const blend = delta_timestamp / (wg->t - current_timestamp);
+    bv_store(bezier_store.t + slot, bv_select(snap, t, bv_set1(current_timestamp)));
+}
+#endif
 
-    struct geometry* const bezier[4] = {
-        wg_geometry(wg),
-        &wg->ctrl1,
-        &wg->ctrl2,
-        &wg->dest
-    };
+// Tween the slots [begin, end), lanes at a time with a scalar tail.
+static void bezier_update_range(size_t begin, size_t end)
+{
+    size_t slot = begin;
 
-    geometry_blend(bezier[0], bezier[1], bezier[0], blend);
-    geometry_blend(bezier[1], bezier[2], bezier[1], blend);
-    geometry_blend(bezier[2], bezier[3], bezier[2], blend);
+#ifdef BEZIER_LANES
+    for (; slot + BEZIER_LANES <= end; slot += BEZIER_LANES)
+        bezier_update_lanes(slot);
+#endif
 
-    geometry_blend(bezier[0], bezier[1], bezier[0], blend);
-    geometry_blend(bezier[1], bezier[2], bezier[1], blend);
-    
-    geometry_blend(bezier[0], bezier[1], bezier[0], blend);
+    for (; slot < end; slot++)
+        bezier_update_slot(slot);
 }
 
 static void wg_bezier_interupt(struct wg_internal* wg)
 {
-    geometry_copy(&wg->ctrl1, wg_geometry(wg));
-    geometry_copy(&wg->ctrl2, wg_geometry(wg));
-    geometry_copy(&wg->dest, wg_geometry(wg));
+    wg_bezier_put(wg, BEZIER_CTRL1, wg_geometry(wg));
+    wg_bezier_put(wg, BEZIER_CTRL2, wg_geometry(wg));
+    wg_bezier_put(wg, BEZIER_DEST, wg_geometry(wg));
 
-    wg->t = current_timestamp;
+    *wg_bezier_t(wg) = current_timestamp;
 }
 
 static void wg_bezier_default(struct wg_internal* wg)
 {
-	geometry_default(wg_geometry(wg));
-	geometry_default(&wg->ctrl1);
-	geometry_default(&wg->ctrl2);
-	geometry_default(&wg->dest);
+    struct geometry geometry;
+	geometry_default(&geometry);
+
+	geometry_copy(wg_geometry(wg), &geometry);
+	wg_bezier_put(wg, BEZIER_CTRL1, &geometry);
+	wg_bezier_put(wg, BEZIER_CTRL2, &geometry);
+	wg_bezier_put(wg, BEZIER_DEST, &geometry);
+
+    scene_version++;
 }
 
 /*********************************************/
@@ -502,6 +950,8 @@ static void lua_pushroot(lua_State* L, struct wg_internal* wg)
 
 static void root_append(struct root* root, struct wg_internal* branch)
 {
+    scene_version++;
+
     if (root->tail)
         root->tail->next = branch;
     else
@@ -688,7 +1138,8 @@ static struct wg_internal* current_drop;
 
 static struct wg_internal camera;
 
-static void camera_build_transform(const struct geometry* const geometry, ALLEGRO_TRANSFORM* const trans)
+// The view is normally the camera's geometry, a render snapshot passes its own copy.
+static void camera_build_transform(const struct geometry* const view, const struct geometry* const geometry, ALLEGRO_TRANSFORM* const trans)
 {
     al_build_transform(trans,
         geometry->x, geometry->y,
@@ -699,11 +1150,11 @@ static void camera_build_transform(const struct geometry* const geometry, ALLEGR
 
     ALLEGRO_TRANSFORM buffer;
 
-    const double blend_x = camera.x * geometry->c;
-    const double blend_y = camera.y * geometry->c;
-    const double blend_sx = camera.sx * geometry->c + (1 - geometry->c);
-    const double blend_sy = camera.sy * geometry->c + (1 - geometry->c);
-    const double blend_a = camera.a * geometry->c;
+    const double blend_x = view->x * geometry->c;
+    const double blend_y = view->y * geometry->c;
+    const double blend_sx = view->sx * geometry->c + (1 - geometry->c);
+    const double blend_sy = view->sy * geometry->c + (1 - geometry->c);
+    const double blend_a = view->a * geometry->c;
 
     al_build_transform(&buffer,
         blend_x, blend_y,
@@ -719,16 +1170,16 @@ static int camera_push(lua_State* L)
     luaL_checktype(L, -1, LUA_TTABLE);
 
     struct geometry geometry;
-    geometry_copy(&geometry, &camera.dest);
+    wg_bezier_get(&camera, BEZIER_DEST, &geometry);
     lua_getgeometry(-1, &geometry);
-    geometry_copy(&camera.dest, & geometry);
+    wg_bezier_put(&camera, BEZIER_DEST, &geometry);
 
     lua_getfield(L, -1, "t");
 
     if (lua_type(lua_state, -1) == LUA_TNUMBER)
-        camera.t = lua_tonumber(lua_state, -1);
+        wg_bezier_until(&camera, lua_tonumber(lua_state, -1));
     else
-        camera.t = current_timestamp;
+        wg_bezier_until(&camera, current_timestamp);
 
     return 0;
 }
@@ -739,7 +1190,7 @@ static int camera_set(lua_State* L)
     luaL_checktype(L, -1, LUA_TTABLE);
 
     struct geometry geometry;
-    geometry_copy(&geometry, &camera.dest);
+    wg_bezier_get(&camera, BEZIER_DEST, &geometry);
     lua_getgeometry(-1, &geometry);
     wg_bezier_set(&camera, &geometry);
 
@@ -748,6 +1199,10 @@ static int camera_set(lua_State* L)
 
 static void camera_init()
 {
+    // The first slot, so the camera is always slot 0.
+    if (!bezier_alloc(&camera))
+        fprintf(stderr, "failed to allocate the bezier store\n");
+
     geometry_default(wg_geometry(&camera));
     wg_bezier_default(&camera);
     lua_pushcfunction(lua_state, camera_push);
@@ -767,6 +1222,12 @@ static ALLEGRO_BITMAP* offscreen_bitmap;
 
 static ALLEGRO_SHADER* onscreen_shader;
 
+// With a render thread picking happens there, the main thread uses the latest result it has collected.
+static bool snapshot_picking;
+static struct wg_internal* snapshot_picked;
+static size_t snapshot_frame;           // Snapshots taken so far
+static size_t snapshot_stale_frame;     // Picks from this snapshot or older may name a collected widget
+
 static void offscreen_shader_init()
 {
     // Build the offscreen shader and bitmap
@@ -790,9 +1251,8 @@ static void offscreen_shader_init()
         return;
     }
 
-    offscreen_bitmap = al_create_bitmap(
-        al_get_bitmap_width(al_get_target_bitmap()),
-        al_get_bitmap_width(al_get_target_bitmap()));
+    // Only the pixel under the mouse is ever drawn.
+    offscreen_bitmap = al_create_bitmap(1, 1);
 }
 
 static void onscreen_shader_init()
@@ -805,129 +1265,633 @@ static void onscreen_shader_init()
         return;
     }
 
-    if (!al_attach_shader_source_file(onscreen_shader, ALLEGRO_PIXEL_SHADER, "shaders/onscreen.frag"))
+    if (!al_attach_shader_source_file(onscreen_shader, ALLEGRO_PIXEL_SHADER, "shaders/onscreen.frag"))
+    {
+        fprintf(stderr, "Failed to attach main renderer pixel shader.\n%s\n", al_get_shader_log(onscreen_shader));
+        return;
+    }
+
+    if (!al_build_shader(onscreen_shader))
+    {
+        fprintf(stderr, "Failed to build main renderer shader.\n%s\n", al_get_shader_log(onscreen_shader));
+        return;
+    }
+
+    ALLEGRO_DISPLAY* const display = al_get_current_display();
+    const float dimensions[2] = { al_get_display_width(display),al_get_display_height(display) };
+
+    al_use_shader(onscreen_shader);
+    al_set_shader_float_vector("display_dimensions", 2, dimensions, 1);
+    al_use_shader(NULL);
+
+    return;
+}
+
+void widget_interface_shader_predraw()
+{
+    al_use_shader(onscreen_shader);
+    glDisable(GL_STENCIL_TEST);
+    al_set_shader_float("current_timestamp", current_timestamp);
+
+    if (step_timestamp == 0)
+        wg_bezier_update(&camera);
+}
+
+// The offscreen pass only ever renders the one pixel being picked, the origin moves it to offscreen_bitmap's (0, 0).
+static int pick_origin_x, pick_origin_y;
+
+// Draw the widget's mask in the color encoding id, exact in the 8 bits per channel offscreen_bitmap.
+static void mask_widget(const struct geometry* const view, struct wg_internal* wg, size_t id)
+{
+    const float color_buffer[3] = {
+        (id & 0xFF) / 255.0f,
+        ((id >> 8) & 0xFF) / 255.0f,
+        ((id >> 16) & 0xFF) / 255.0f
+    };
+
+    al_set_shader_float_vector("picker_color", 3, color_buffer, 1);
+    ALLEGRO_TRANSFORM buffer;
+    camera_build_transform(view, (struct geometry* const)wg_geometry(wg), (ALLEGRO_TRANSFORM* const)&buffer);
+    al_translate_transform(&buffer, -pick_origin_x, -pick_origin_y);
+    al_use_transform(&buffer);
+    wg->jumptable->mask(wg_public(wg));
+}
+
+static size_t pick_decode(unsigned char r, unsigned char g, unsigned char b)
+{
+    return r | (size_t)g << 8 | (size_t)b << 16;
+}
+
+// Start an offscreen pass masking widgets over (x, y), returns the bitmap to restore afterwards.
+static ALLEGRO_BITMAP* pick_begin(int x, int y)
+{
+    ALLEGRO_BITMAP* original_bitmap = al_get_target_bitmap();
+
+    pick_origin_x = x;
+    pick_origin_y = y;
+
+    al_set_target_bitmap(offscreen_bitmap);
+    glDisable(GL_STENCIL_TEST);
+
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+
+    al_use_shader(offscreen_shader);
+
+    return original_bitmap;
+}
+
+// Finish the offscreen pass and read back the id under (x, y), 0 for nothing.
+// Waits on the GPU, the render thread uses this since stalling it doesn't hold up updates.
+static size_t pick_end(ALLEGRO_BITMAP* original_bitmap)
+{
+    al_set_target_bitmap(original_bitmap);
+
+    unsigned char r, g, b;
+    al_unmap_rgb(al_get_pixel(offscreen_bitmap, 0, 0), &r, &g, &b);
+
+    return pick_decode(r, g, b);
+}
+
+// Pixel buffers the main thread reads ids back into, each pass collects the previous one's id
+// so the update never waits on the GPU at the cost of picking a frame late.
+#define PICK_PBO_CNT 2
+
+// What a pass picked, a read back only answers picks with the same tag.
+// The stamp is pick_id_stamp at the time of the pass, ids handed out since then weren't in it.
+// A read back from an earlier scene_version answers the pick, but may no longer be what's there.
+struct pick_tag
+{
+    int x, y;
+    const struct wg_internal* hidden;
+    size_t stamp;
+    size_t scene_version;
+};
+
+static GLuint pick_pbo[PICK_PBO_CNT];
+static GLsync pick_sync[PICK_PBO_CNT];
+static struct pick_tag pick_pbo_tag[PICK_PBO_CNT];
+static size_t pick_pbo_next;
+
+// The latest id collected and the tag of the pass it came from.
+static bool pick_async_ready;
+static size_t pick_async_id;
+static struct pick_tag pick_async_tag;
+
+static void pick_async_init()
+{
+    if (!al_have_opengl_extension("GL_ARB_pixel_buffer_object") || !al_have_opengl_extension("GL_ARB_sync"))
+        return;
+
+    glGenBuffers(PICK_PBO_CNT, pick_pbo);
+
+    for (size_t i = 0; i < PICK_PBO_CNT; i++)
+    {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pick_pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, 4, NULL, GL_STREAM_READ);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Take the id out of the given pixel buffer if the GPU is done with it.
+static void pick_async_collect(size_t i)
+{
+    if (!pick_sync[i])
+        return;
+
+    if (glClientWaitSync(pick_sync[i], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED)
+        return;
+
+    glDeleteSync(pick_sync[i]);
+    pick_sync[i] = NULL;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pick_pbo[i]);
+
+    const unsigned char* const pixel = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, 4, GL_MAP_READ_BIT);
+
+    if (pixel)
+    {
+        pick_async_ready = true;
+        pick_async_id = pick_decode(pixel[0], pixel[1], pixel[2]);
+        pick_async_tag = pick_pbo_tag[i];
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Finish the offscreen pass queuing its read back, then take the id of the latest pass the GPU has finished.
+// Returns false if that pass was over somewhere else or hid another widget, its id says nothing about this pick.
+static bool pick_end_async(ALLEGRO_BITMAP* original_bitmap, const struct pick_tag* tag, size_t* id)
+{
+    const size_t i = pick_pbo_next;
+    pick_pbo_next = (i + 1) % PICK_PBO_CNT;
+
+    // The buffer is about to be reused, collect it if possible and drop it if not.
+    pick_async_collect(i);
+
+    if (pick_sync[i])
+    {
+        glDeleteSync(pick_sync[i]);
+        pick_sync[i] = NULL;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pick_pbo[i]);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    pick_sync[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    pick_pbo_tag[i] = *tag;
+
+    al_set_target_bitmap(original_bitmap);
+
+    pick_async_collect((i + PICK_PBO_CNT - 1) % PICK_PBO_CNT);
+
+    if (!pick_async_ready || pick_async_tag.x != tag->x || pick_async_tag.y != tag->y ||
+        pick_async_tag.hidden != tag->hidden)
+        return false;
+
+    *id = pick_async_id;
+
+    return true;
+}
+
+// Picks on the CPU, falling back to the offscreen pass when a widget without a hit test could be on top.
+// The hud is drawn over the board and is only a few widgets whose shape can follow their state, so it's tested directly.
+// The board is tested against a uniform grid of the widgets' transformed bounding boxes,
+// each bounded widget binned into every cell its box overlaps, in drawing order.
+// The grid is kept across picks until the scene, the hidden widget or the display size changes.
+#define PICK_CELL 64
+
+struct pick_entry
+{
+    struct wg_internal* wg;
+    size_t order;
+    ALLEGRO_TRANSFORM inverse;
+    float x0, y0, x1, y1;
+};
+
+static struct pick_entry* pick_entries;
+static size_t pick_entries_allocated;
+static size_t pick_entry_cnt;
+
+// Cell c holds pick_cell_items[pick_cell_start[c]] to pick_cell_items[pick_cell_start[c + 1]]
+static size_t* pick_cell_start;
+static size_t* pick_cell_items;
+static size_t pick_cells_allocated;
+static size_t pick_items_allocated;
+static int pick_cols, pick_rows;
+
+// Drawing order of the topmost widget without a hit test, 0 for none.
+static size_t pick_unbounded_top;
+
+// What the grid was built from.
+static bool pick_index_valid;
+static size_t pick_index_version;
+static const struct wg_internal* pick_index_hidden;
+static int pick_index_width, pick_index_height;
+
+// Grow a pick array to hold at least cnt elements.
+#define PICK_RESERVE(array, allocated, cnt) pick_reserve((void**)&(array), &(allocated), (cnt), sizeof(*(array)))
+
+static bool pick_reserve(void** array, size_t* allocated, size_t cnt, size_t size)
+{
+    if (cnt <= *allocated)
+        return true;
+
+    const size_t new_cnt = 2 * cnt + 64;
+    void* const memsafe_hande = realloc(*array, new_cnt * size);
+
+    if (!memsafe_hande)
+        return false;
+
+    *array = memsafe_hande;
+    *allocated = new_cnt;
+
+    return true;
+}
+
+static void pick_index_append(const struct geometry* const view, struct wg_internal* wg, size_t order)
+{
+    if (!wg->jumptable->hit)
+    {
+        pick_unbounded_top = order;
+        return;
+    }
+
+    if (!PICK_RESERVE(pick_entries, pick_entries_allocated, pick_entry_cnt + 1))
+    {
+        pick_unbounded_top = order;
+        return;
+    }
+
+    struct pick_entry* const entry = pick_entries + pick_entry_cnt++;
+    entry->wg = wg;
+    entry->order = order;
+
+    camera_build_transform(view, wg_geometry(wg), &entry->inverse);
+
+    const float corners[4][2] = {
+        { -wg->hw, -wg->hh },
+        { wg->hw, -wg->hh },
+        { wg->hw, wg->hh },
+        { -wg->hw, wg->hh }
+    };
+
+    entry->x0 = entry->y0 = FLT_MAX;
+    entry->x1 = entry->y1 = -FLT_MAX;
+
+    for (size_t i = 0; i < 4; i++)
+    {
+        float x = corners[i][0];
+        float y = corners[i][1];
+
+        al_transform_coordinates(&entry->inverse, &x, &y);
+
+        entry->x0 = fminf(entry->x0, x);
+        entry->y0 = fminf(entry->y0, y);
+        entry->x1 = fmaxf(entry->x1, x);
+        entry->y1 = fmaxf(entry->y1, y);
+    }
+
+    al_invert_transform(&entry->inverse);
+}
+
+// Cells overlapped by an entry, false if it's entirely off screen.
+static bool pick_entry_cells(const struct pick_entry* entry, int* c0, int* r0, int* c1, int* r1)
+{
+    if (entry->x1 < 0 || entry->y1 < 0 || entry->x0 >= pick_cols * PICK_CELL || entry->y0 >= pick_rows * PICK_CELL)
+        return false;
+
+    *c0 = entry->x0 < 0 ? 0 : (int)(entry->x0 / PICK_CELL);
+    *r0 = entry->y0 < 0 ? 0 : (int)(entry->y0 / PICK_CELL);
+    *c1 = entry->x1 >= pick_cols * PICK_CELL ? pick_cols - 1 : (int)(entry->x1 / PICK_CELL);
+    *r1 = entry->y1 >= pick_rows * PICK_CELL ? pick_rows - 1 : (int)(entry->y1 / PICK_CELL);
+
+    return true;
+}
+
+// Rebuild the grid from the board's current geometry unless it's already up to date, false if memory ran out.
+static bool pick_index_build(const struct wg_internal* const hidden)
+{
+    ALLEGRO_DISPLAY* const display = al_get_current_display();
+    const int width = al_get_display_width(display);
+    const int height = al_get_display_height(display);
+
+    if (pick_index_valid && pick_index_version == scene_version && pick_index_hidden == hidden &&
+        pick_index_width == width && pick_index_height == height)
+        return true;
+
+    pick_index_valid = false;
+
+    pick_cols = (width + PICK_CELL - 1) / PICK_CELL;
+    pick_rows = (height + PICK_CELL - 1) / PICK_CELL;
+
+    const size_t cells = (size_t)pick_cols * pick_rows;
+
+    if (!PICK_RESERVE(pick_cell_start, pick_cells_allocated, cells + 1))
+        return false;
+
+    // Widgets are ordered as pick_gpu masks them, starting from 1.
+    const struct geometry* const view = wg_geometry(&camera);
+    size_t order = 1;
+
+    pick_entry_cnt = 0;
+    pick_unbounded_top = 0;
+
+    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next, order++)
+        if (zone != hidden)
+            pick_index_append(view, zone, order);
+
+    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
+        for (struct wg_internal* piece = zone->head; piece; piece = piece->next, order++)
+            if (piece != hidden)
+                pick_index_append(view, piece, order);
+
+    // Count, prefix sum, then fill so each cell keeps drawing order.
+    memset(pick_cell_start, 0, (cells + 1) * sizeof(size_t));
+
+    for (size_t i = 0; i < pick_entry_cnt; i++)
+    {
+        int c0, r0, c1, r1;
+
+        if (pick_entry_cells(pick_entries + i, &c0, &r0, &c1, &r1))
+            for (int r = r0; r <= r1; r++)
+                for (int c = c0; c <= c1; c++)
+                    pick_cell_start[r * pick_cols + c + 1]++;
+    }
+
+    for (size_t c = 0; c < cells; c++)
+        pick_cell_start[c + 1] += pick_cell_start[c];
+
+    if (!PICK_RESERVE(pick_cell_items, pick_items_allocated, pick_cell_start[cells]))
+        return false;
+
+    for (size_t i = 0; i < pick_entry_cnt; i++)
+    {
+        int c0, r0, c1, r1;
+
+        if (pick_entry_cells(pick_entries + i, &c0, &r0, &c1, &r1))
+            for (int r = r0; r <= r1; r++)
+                for (int c = c0; c <= c1; c++)
+                    pick_cell_items[pick_cell_start[r * pick_cols + c]++] = i;
+    }
+
+    // Filling advanced each start to the next cell's, shift them back.
+    for (size_t c = cells; c > 0; c--)
+        pick_cell_start[c] = pick_cell_start[c - 1];
+
+    pick_cell_start[0] = 0;
+
+    pick_index_valid = true;
+    pick_index_version = scene_version;
+    pick_index_hidden = hidden;
+    pick_index_width = width;
+    pick_index_height = height;
+
+    return true;
+}
+
+// Test a widget at the pixel center (px, py), false if it isn't under it.
+static bool pick_hit(const struct geometry* const view, struct wg_internal* wg, float px, float py)
+{
+    ALLEGRO_TRANSFORM inverse;
+
+    camera_build_transform(view, wg_geometry(wg), &inverse);
+    al_invert_transform(&inverse);
+    al_transform_coordinates(&inverse, &px, &py);
+
+    return wg->jumptable->hit(wg_public(wg), px, py);
+}
+
+// Test a hud widget unless it's hidden, false if it has no hit test.
+// Later widgets are drawn on top, so the last hit wins.
+static bool pick_hud_widget(const struct geometry* const view, struct wg_internal* wg,
+    const struct wg_internal* const hidden, float px, float py, struct wg_internal** picked)
+{
+    if (wg == hidden)
+        return true;
+
+    if (!wg->jumptable->hit)
+        return false;
+
+    if (pick_hit(view, wg, px, py))
+        *picked = wg;
+
+    return true;
+}
+
+// Pick the topmost hud widget under the pixel center (px, py), false if one without a hit test is in the way.
+static bool pick_hud(const struct wg_internal* const hidden, float px, float py, struct wg_internal** picked)
+{
+    const struct geometry* const view = wg_geometry(&camera);
+
+    for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
+    {
+        if (!pick_hud_widget(view, frame, hidden, px, py, picked))
+            return false;
+
+        for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
+            if (!pick_hud_widget(view, hud, hidden, px, py, picked))
+                return false;
+    }
+
+    return true;
+}
+
+// Pick the topmost widget under (x, y), false if the offscreen pass is needed to know.
+static bool pick_cpu(int x, int y, struct wg_internal** picked)
+{
+    const struct wg_internal* const hidden = hover_on_top() ? current_hover : NULL;
+
+    *picked = NULL;
+
+    // Sample the pixel center like the offscreen pass.
+    const float px = x + 0.5f;
+    const float py = y + 0.5f;
+
+    if (!pick_hud(hidden, px, py, picked))
+        return false;
+
+    if (*picked)
+        return true;
+
+    if (!pick_index_build(hidden))
+        return false;
+
+    if (x < 0 || y < 0 || x >= pick_cols * PICK_CELL || y >= pick_rows * PICK_CELL)
+        return true;
+
+    const size_t cell = (size_t)(y / PICK_CELL) * pick_cols + x / PICK_CELL;
+
+    for (size_t i = pick_cell_start[cell + 1]; i > pick_cell_start[cell]; i--)
     {
-        fprintf(stderr, "Failed to attach main renderer pixel shader.\n%s\n", al_get_shader_log(onscreen_shader));
-        return;
-    }
+        const struct pick_entry* const entry = pick_entries + pick_cell_items[i - 1];
 
-    if (!al_build_shader(onscreen_shader))
-    {
-        fprintf(stderr, "Failed to build main renderer shader.\n%s\n", al_get_shader_log(onscreen_shader));
-        return;
-    }
+        // Anything further down might be covered by a widget without a hit test.
+        if (entry->order < pick_unbounded_top)
+            return false;
 
-    ALLEGRO_DISPLAY* const display = al_get_current_display();
-    const float dimensions[2] = { al_get_display_width(display),al_get_display_height(display) };
+        if (px < entry->x0 || px > entry->x1 || py < entry->y0 || py > entry->y1)
+            continue;
 
-    al_use_shader(onscreen_shader);
-    al_set_shader_float_vector("display_dimensions", 2, dimensions, 1);
-    al_use_shader(NULL);
+        float lx = px;
+        float ly = py;
 
-    return;
+        al_transform_coordinates(&entry->inverse, &lx, &ly);
+
+        if (entry->wg->jumptable->hit(wg_public(entry->wg), lx, ly))
+        {
+            *picked = entry->wg;
+            return true;
+        }
+    }
+
+    return pick_unbounded_top == 0;
 }
 
-void widget_interface_shader_predraw()
+// Widget of each pick id, ids are handed out at allocation and outlive a late read back.
+// Id 0 is nothing, freed ids are reused straight away so each hand out is stamped,
+// a read back from a pass before the stamp was of the id's previous widget.
+static struct
 {
-    al_use_shader(onscreen_shader);
-    glDisable(GL_STENCIL_TEST);
-    al_set_shader_float("current_timestamp", current_timestamp);
+    struct wg_internal* wg;
+    size_t stamp;
+}* pick_ids;
+static size_t pick_ids_allocated;
+static size_t pick_id_cnt = 1;
+static size_t pick_id_stamp;
 
-    wg_bezier_update(&camera);
-}
+static size_t* pick_ids_free;
+static size_t pick_ids_free_allocated;
+static size_t pick_ids_free_cnt;
 
-static void mask_widget(struct wg_internal* wg, size_t* picker_index)
+// Returns 0 if out of ids or memory, the widget then can't be picked by the offscreen pass.
+static size_t pick_id_alloc(struct wg_internal* wg)
 {
-    if (hover_on_top() && wg == current_hover)
-    {
-        picker_index++;
-        return;
-    }
+    size_t id;
 
-    float color_buffer[3];
-    size_t pick_buffer = (*picker_index)++;
+    if (pick_ids_free_cnt)
+        id = pick_ids_free[--pick_ids_free_cnt];
+    else if (pick_id_cnt < 1 << 24 && PICK_RESERVE(pick_ids, pick_ids_allocated, pick_id_cnt + 1))
+        id = pick_id_cnt++;
+    else
+        return 0;
 
-    for (size_t i = 0; i < 3; i++)
-    {
-        color_buffer[i] = ((float)(pick_buffer % 200)) / 200;
-        pick_buffer /= 200;
-    }
+    pick_ids[id].wg = wg;
+    pick_ids[id].stamp = ++pick_id_stamp;
 
-    al_set_shader_float_vector("picker_color", 3, color_buffer, 1);
-    ALLEGRO_TRANSFORM buffer;
-    camera_build_transform((struct geometry* const)wg_geometry(wg), (ALLEGRO_TRANSFORM* const)&buffer);
-    al_use_transform(&buffer);
-    wg->jumptable->mask(wg_public(wg));
+    return id;
 }
 
-// Handle picking mouse inputs using off screen drawing.
-static inline struct wg_internal* pick(int x, int y)
+static void pick_id_release(size_t id)
 {
-    ALLEGRO_BITMAP* original_bitmap = al_get_target_bitmap();
-
-    al_set_target_bitmap(offscreen_bitmap);
-    al_set_clipping_rectangle(x - 1, y - 1, 3, 3);
-    glDisable(GL_STENCIL_TEST);
-
-    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+    if (id == 0)
+        return;
 
-    al_use_shader(offscreen_shader);
+    pick_ids[id].wg = NULL;
 
-    size_t picker_index = 1;
+    if (PICK_RESERVE(pick_ids_free, pick_ids_free_allocated, pick_ids_free_cnt + 1))
+        pick_ids_free[pick_ids_free_cnt++] = id;
+}
 
-    const bool hide_hover = hover_on_top();
+// Handle picking mouse inputs using off screen drawing.
+// Returns false if the widget under (x, y) isn't known yet, unless wait is set the read back isn't waited on.
+// exact is set if the result is of the current scene rather than one a frame or so late.
+static bool pick_gpu(int x, int y, bool wait, struct wg_internal** picked, bool* exact)
+{
+    ALLEGRO_BITMAP* const original_bitmap = pick_begin(x, y);
 
-    struct wg_internal* zone = (struct wg_internal*)root_board->head;
+    const struct geometry* const view = wg_geometry(&camera);
+    const struct wg_internal* const hidden = hover_on_top() ? current_hover : NULL;
 
     for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
-        mask_widget(zone, &picker_index);
+        if (zone != hidden)
+            mask_widget(view, zone, zone->pick_id);
 
     for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
         for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
-            mask_widget(piece, &picker_index);
+            if (piece != hidden)
+                mask_widget(view, piece, piece->pick_id);
 
     for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
     {
-        mask_widget(frame, &picker_index);
+        if (frame != hidden)
+            mask_widget(view, frame, frame->pick_id);
 
         for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
-            mask_widget(hud, &picker_index);
+            if (hud != hidden)
+                mask_widget(view, hud, hud->pick_id);
     }
 
-    al_set_target_bitmap(original_bitmap);
+    const struct pick_tag tag = { x, y, hidden, pick_id_stamp, scene_version };
+    size_t id;
 
-    float color_buffer[3];
+    *exact = true;
 
-    al_unmap_rgb_f(al_get_pixel(offscreen_bitmap, x, y),
-        color_buffer, color_buffer + 1, color_buffer + 2);
+    if (!pick_pbo[0])
+        id = pick_end(original_bitmap);
+    else if (!pick_end_async(original_bitmap, &tag, &id) ||
+        (id < pick_id_cnt && pick_ids[id].stamp > pick_async_tag.stamp) ||
+        (wait && pick_async_tag.scene_version != scene_version))
+    {
+        if (!wait)
+            return false;
 
-    size_t index = round(200 * color_buffer[0]) +
-        200 * round(200 * color_buffer[1]) +
-        40000 * round(200 * color_buffer[2]);
+        id = pick_end(original_bitmap);
+    }
+    else
+        *exact = pick_async_tag.scene_version == scene_version;
 
-    if (index == 0)
-        return NULL;
+    *picked = id < pick_id_cnt ? pick_ids[id].wg : NULL;
 
-    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
-        if (--index == 0)
-            return zone;
+    return true;
+}
 
-    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
-        for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
-            if (--index == 0)
-                return piece;
+// The last pick, reused while the scene, the mouse and the hidden widget haven't changed.
+static struct
+{
+    bool valid;
+    size_t scene_version;
+    int x, y;
+    const struct wg_internal* hidden;
+    struct wg_internal* picked;
+} pick_cache;
 
-    for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
-    {
-        if (--index == 0)
-            return frame;
+// Whether the last pick still holds for (x, y) in the current scene.
+static inline bool pick_cached(int x, int y)
+{
+    const struct wg_internal* const hidden = hover_on_top() ? current_hover : NULL;
 
-        for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
-            if (--index == 0)
-                return hud;
+    return pick_cache.valid && pick_cache.scene_version == scene_version &&
+        pick_cache.x == x && pick_cache.y == y && pick_cache.hidden == hidden;
+}
+
+// Returns false if the widget under (x, y) isn't known yet, see pick_gpu.
+static inline bool pick(int x, int y, bool wait, struct wg_internal** picked)
+{
+    const struct wg_internal* const hidden = hover_on_top() ? current_hover : NULL;
+
+    if (pick_cached(x, y))
+    {
+        *picked = pick_cache.picked;
+        return true;
     }
 
-    return NULL;
+    bool valid = pick_cpu(x, y, picked);
+
+    // An asynchronous read back from an earlier scene is a frame late, so isn't kept.
+    if (!valid && !pick_gpu(x, y, wait, picked, &valid))
+        return false;
+
+    pick_cache.valid = valid;
+    pick_cache.scene_version = scene_version;
+    pick_cache.x = x;
+    pick_cache.y = y;
+    pick_cache.hidden = hidden;
+    pick_cache.picked = *picked;
+
+    return true;
 }
 
 /*********************************************/
@@ -1084,6 +2048,9 @@ static void idle_zones()
 
 static void call_lua(struct wg_internal* const wg, const char* key, struct wg_internal* const obj)
 {
+    // The callback, or the jumptable one alongside it, may change any widget.
+    scene_version++;
+
     lua_pushwidget(lua_state, wg);
 
     // In the end this might be removable, keeping for now.
@@ -1104,6 +2071,8 @@ static void call_lua(struct wg_internal* const wg, const char* key, struct wg_in
 
     lua_pushvalue(lua_state, -3);
 
+    TRACE_BEGIN(trace_begin);
+
     if (obj)
     {
         lua_pushwidget(lua_state, obj);
@@ -1115,6 +2084,8 @@ static void call_lua(struct wg_internal* const wg, const char* key, struct wg_in
         lua_pcall(lua_state, 1, 0, 0);
     }
 
+    TRACE_END(trace_begin, key, wg->jumptable->type, wg);
+
     lua_pop(lua_state, 2);
 }
 
@@ -1266,14 +2237,15 @@ void call_drag_end_drop(struct wg_internal* wg, struct wg_internal* wg2)
     wg_remove(piece);
     wg_append((struct wg_internal*)zone, (struct wg_internal*) piece);
 
-    struct geometry geometry;
-    geometry_copy(&geometry, &zone->dest);
+    struct geometry geometry, piece_dest;
+    wg_bezier_get((struct wg_internal*)zone, BEZIER_DEST, &geometry);
+    wg_bezier_get((struct wg_internal*)piece, BEZIER_DEST, &piece_dest);
 
-    geometry.hh = piece->dest.hh;
-    geometry.hw = piece->dest.hw;
+    geometry.hh = piece_dest.hh;
+    geometry.hw = piece_dest.hw;
 
-    geometry_copy(&piece->dest, &geometry);
-    piece->t = current_timestamp + 0.1;
+    wg_bezier_put((struct wg_internal*)piece, BEZIER_DEST, &geometry);
+    wg_bezier_until((struct wg_internal*)piece, current_timestamp + 0.1);
 
     if (wg->jumptable->drag_end_drop)
         wg->jumptable->drag_end_drop(wg_public(wg), wg_public(wg2));
@@ -1314,6 +2286,11 @@ static void prevent_stale_pointers(struct wg_internal* const ptr)
     // WARNING: this function is called in widget gc
     //  at this location the weak references in widgets have been collected
     //  hence I have disabled the callbacks, because they are currently intertwined with call_lua
+    if (snapshot_picked == ptr)
+        snapshot_picked = NULL;
+
+    snapshot_stale_frame = snapshot_frame;
+
     if (current_hover == ptr)
     {
         //call(ptr, hover_end);
@@ -1339,7 +2316,7 @@ static void prevent_stale_pointers(struct wg_internal* const ptr)
 }
 
 // Draws the given widget.
-static void draw_widget(const struct wg_internal* const wg)
+static void draw_widget(const struct geometry* const view, const struct wg_internal* const wg)
 {
     //al_set_shader_float("variation", internal->variation);
 
@@ -1351,7 +2328,7 @@ static void draw_widget(const struct wg_internal* const wg)
     }
 
     ALLEGRO_TRANSFORM buffer;
-    camera_build_transform((struct geometry* const) wg_geometry(wg), (ALLEGRO_TRANSFORM* const ) & buffer);
+    camera_build_transform(view, (struct geometry* const) wg_geometry(wg), (ALLEGRO_TRANSFORM* const ) & buffer);
     al_use_transform(&buffer);
 
     material_apply(NULL);
@@ -1375,18 +2352,22 @@ static inline void towards_drag()
     geometry.dx = mouse_x - drag_offset_x;
     geometry.dy = mouse_y - drag_offset_y;
 
-    geometry_copy(&current_hover->dest, &drag_release);
-    current_hover->t = current_timestamp + 0.1;
+    wg_bezier_put(current_hover, BEZIER_DEST, &drag_release);
+    wg_bezier_until(current_hover, current_timestamp + 0.1);
 }
 
 // Updates and calls any callbacks for the last_click, current_hover, current_drop pointers
-static inline void update_drag_pointers()
+// With wait unset the pointers are left as they are if the pick has no answer yet.
+static inline void update_drag_pointers(bool wait)
 {
     // What pointer the picker returns depends on if something is being dragged.
     // If nothing is being dragged the pointer is what's being hovered.
     // If something is being dragged the pointer is what's under the dragged widget.
     //  (The widget under the drag is called the drop).
-    struct wg_internal* const new_pointer = pick(mouse_x, mouse_y);
+    struct wg_internal* new_pointer = snapshot_picked;
+
+    if (!snapshot_picking && !pick(mouse_x, mouse_y, wait, &new_pointer))
+        return;
 
     if (current_hover != new_pointer && (
         widget_engine_state == ENGINE_STATE_IDLE ||
@@ -1426,17 +2407,18 @@ static inline void update_drag_pointers()
 
 			if (new_pointer->snappable)
 			{
-                struct geometry snap_target;    
+                struct geometry snap_target, hover_dest;    
 
-                geometry_copy(&snap_target, &new_pointer->dest);
+                wg_bezier_get(new_pointer, BEZIER_DEST, &snap_target);
+                wg_bezier_get(current_hover, BEZIER_DEST, &hover_dest);
 
 				snap_target.dx += snap_offset_x;
 				snap_target.dy += snap_offset_y;
-                snap_target.hh = current_hover->dest.hh;
-                snap_target.hw = current_hover->dest.hw;
+                snap_target.hh = hover_dest.hh;
+                snap_target.hw = hover_dest.hw;
 
-                geometry_copy(&current_hover->dest, &snap_target);
-                current_hover->t = current_timestamp + 0.1;
+                wg_bezier_put(current_hover, BEZIER_DEST, &snap_target);
+                wg_bezier_until(current_hover, current_timestamp + 0.1);
 
 				widget_engine_state = ENGINE_STATE_TO_SNAP;
 			}
@@ -1473,7 +2455,7 @@ void widget_screen_to_local(const struct wg_base* const wg, double* x, double* y
     float _x = *x;
     float _y = *y;
 
-    camera_build_transform(wg_geometry(wg_internal(wg)), &transform);
+    camera_build_transform(wg_geometry(&camera), wg_geometry(wg_internal(wg)), &transform);
 
     // WARNING: the inbuilt invert only works for 2D transforms
     al_invert_transform(&transform);
@@ -1547,8 +2529,8 @@ static void process_mouse_up(unsigned int button, bool allow_drag_end_drop)
     case ENGINE_STATE_SNAP:
     case ENGINE_STATE_TO_SNAP:
     case ENGINE_STATE_TO_DRAG:
-        geometry_copy(&current_hover->dest, &drag_release);
-        current_hover->t = current_timestamp + 0.1;
+        wg_bezier_put(current_hover, BEZIER_DEST, &drag_release);
+        wg_bezier_until(current_hover, current_timestamp + 0.1);
 
         if (current_drop && allow_drag_end_drop)
         {
@@ -1571,21 +2553,96 @@ static void process_mouse_up(unsigned int button, bool allow_drag_end_drop)
 /*********************************************/
 
 // Draw the widgets in queue order.
+// Geometry of each widget displaced by interpolation while drawing.
+struct interpolation_hold
+{
+    struct wg_internal* wg;
+    struct geometry geometry;
+};
+
+static struct interpolation_hold* interpolation_hold;
+static size_t interpolation_hold_allocated;
+
+// Swap in the geometry between the last two steps, residual_timestamp past the older one.
+static void interpolation_apply(struct wg_internal* wg, size_t* cnt, double blend)
+{
+    // Widgets created since the last step have nothing to interpolate from.
+    if (wg->last_timestamp != current_timestamp)
+        return;
+
+    if (interpolation_hold_allocated <= *cnt)
+    {
+        const size_t new_cnt = 2 * interpolation_hold_allocated + 64;
+
+        struct interpolation_hold* memsafe_hande = realloc(interpolation_hold, new_cnt * sizeof(struct interpolation_hold));
+
+        if (!memsafe_hande)
+            return;
+
+        interpolation_hold = memsafe_hande;
+        interpolation_hold_allocated = new_cnt;
+    }
+
+    struct interpolation_hold* const hold = interpolation_hold + (*cnt)++;
+
+    hold->wg = wg;
+    geometry_copy(&hold->geometry, wg_geometry(wg));
+    geometry_blend(wg_geometry(wg), &hold->geometry, &wg->last_geometry, blend);
+}
+
+static size_t interpolation_begin()
+{
+    size_t cnt = 0;
+
+    double blend = residual_timestamp / step_timestamp;
+    blend = blend < 0 ? 0 : (blend > 1 ? 1 : blend);
+
+    interpolation_apply(&camera, &cnt, blend);
+
+    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
+        interpolation_apply(zone, &cnt, blend);
+
+    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
+        for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
+            interpolation_apply(piece, &cnt, blend);
+
+    for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
+    {
+        interpolation_apply(frame, &cnt, blend);
+
+        for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
+            interpolation_apply(hud, &cnt, blend);
+    }
+
+    return cnt;
+}
+
+static void interpolation_end(size_t cnt)
+{
+    for (size_t i = 0; i < cnt; i++)
+        geometry_copy(wg_geometry(interpolation_hold[i].wg), &interpolation_hold[i].geometry);
+}
+
 void widget_engine_draw()
 {    
+    // With fixed steps the simulation is up to a step ahead of the display, so draw between the last two steps.
+    const size_t interpolation_cnt = step_timestamp > 0 ? interpolation_begin() : 0;
+
+    const struct geometry* const view = wg_geometry(&camera);
+
     for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
-        draw_widget(zone);
+        draw_widget(view, zone);
 
     for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
         for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
-            draw_widget(piece);
+            draw_widget(view, piece);
 
     for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
     {
-        draw_widget(frame);
+        draw_widget(view, frame);
 
         for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
-            draw_widget(hud);
+            draw_widget(view, hud);
     }
 
     if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
@@ -1599,6 +2656,8 @@ void widget_engine_draw()
             al_map_rgba_f(0, 0, 0, 0.5));
     }
 
+    interpolation_end(interpolation_cnt);
+
 #ifdef WIDGET_DEBUG_DRAW
     al_use_shader(NULL);
     glDisable(GL_STENCIL_TEST);
@@ -1616,13 +2675,206 @@ void widget_engine_draw()
 #endif
 }
 
+/*********************************************/
+/*              Render Snapshot              */
+/*********************************************/
+
+// A copy of everything widget drawing reads so a render thread can draw one frame while the main thread simulates the next.
+struct widget_snapshot
+{
+    struct wg_internal camera;
+    double timestamp;
+    bool tabbed_out;
+
+    // Widgets copied back to back in draw order, and the widget each copy came from.
+    char* data;
+    size_t data_used;
+    size_t data_allocated;
+
+    size_t* offset;
+    struct wg_internal** source;
+    size_t cnt;
+    size_t allocated;
+
+    // Filled by the render thread after drawing, collected when the snapshot is next taken.
+    int pick_x, pick_y;
+    struct wg_internal* pick_hidden;
+    struct wg_internal* picked;
+    size_t frame;
+};
+
+static struct widget_snapshot widget_snapshots[2];
+
+static struct wg_internal* snapshot_widget(const struct widget_snapshot* const snapshot, size_t i)
+{
+    return (struct wg_internal*)(snapshot->data + snapshot->offset[i]);
+}
+
+static void snapshot_append(struct widget_snapshot* const snapshot, struct wg_internal* wg)
+{
+    if (snapshot->allocated <= snapshot->cnt)
+    {
+        const size_t new_cnt = 2 * snapshot->allocated + 64;
+
+        size_t* memsafe_offset = realloc(snapshot->offset, new_cnt * sizeof(size_t));
+
+        if (!memsafe_offset)
+            return;
+
+        snapshot->offset = memsafe_offset;
+
+        struct wg_internal** memsafe_source = realloc(snapshot->source, new_cnt * sizeof(struct wg_internal*));
+
+        if (!memsafe_source)
+            return;
+
+        snapshot->source = memsafe_source;
+        snapshot->allocated = new_cnt;
+    }
+
+    // Keep each copy aligned like the userdata it came from.
+    const size_t offset = (snapshot->data_used + 15) & ~(size_t)15;
+
+    if (snapshot->data_allocated < offset + wg->size)
+    {
+        const size_t new_size = 2 * snapshot->data_allocated + wg->size + 4096;
+
+        char* memsafe_hande = realloc(snapshot->data, new_size);
+
+        if (!memsafe_hande)
+            return;
+
+        snapshot->data = memsafe_hande;
+        snapshot->data_allocated = new_size;
+    }
+
+    memcpy_s(snapshot->data + offset, snapshot->data_allocated - offset, wg, wg->size);
+
+    snapshot->offset[snapshot->cnt] = offset;
+    snapshot->source[snapshot->cnt++] = wg;
+    snapshot->data_used = offset + wg->size;
+}
+
+// Picking needs the display, once a render thread owns it the main thread only uses picks collected from snapshots.
+void widget_engine_snapshot_picking()
+{
+    snapshot_picking = true;
+}
+
+// Copy the widgets into the given snapshot, the render thread must be done with it.
+// Also collects the pick the render thread made the last time it drew this snapshot.
+void widget_engine_snapshot(size_t idx)
+{
+    struct widget_snapshot* const snapshot = widget_snapshots + idx;
+
+    if (snapshot->frame > snapshot_stale_frame)
+        snapshot_picked = snapshot->picked;
+
+    snapshot->frame = ++snapshot_frame;
+    snapshot->camera = camera;
+    snapshot->timestamp = current_timestamp;
+    snapshot->tabbed_out = widget_engine_state == ENGINE_STATE_TABBED_OUT;
+
+    snapshot->pick_x = mouse_x;
+    snapshot->pick_y = mouse_y;
+    snapshot->pick_hidden = hover_on_top() ? current_hover : NULL;
+    snapshot->picked = NULL;
+
+    snapshot->data_used = 0;
+    snapshot->cnt = 0;
+
+    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
+        snapshot_append(snapshot, zone);
+
+    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
+        for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
+            snapshot_append(snapshot, piece);
+
+    for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
+    {
+        snapshot_append(snapshot, frame);
+
+        for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
+            snapshot_append(snapshot, hud);
+    }
+}
+
+// Render thread counterpart of widget_interface_shader_predraw.
+// The copies are the snapshot's own so fixed step interpolation is done in place.
+void widget_engine_snapshot_predraw(size_t idx)
+{
+    struct widget_snapshot* const snapshot = widget_snapshots + idx;
+
+    al_use_shader(onscreen_shader);
+    glDisable(GL_STENCIL_TEST);
+    al_set_shader_float("current_timestamp", snapshot->timestamp);
+
+    if (step_timestamp == 0)
+        return;
+
+    double blend = (al_get_time() - snapshot->timestamp) / step_timestamp;
+    blend = blend < 0 ? 0 : (blend > 1 ? 1 : blend);
+
+    if (snapshot->camera.last_timestamp == snapshot->timestamp)
+        geometry_blend(wg_geometry(&snapshot->camera), wg_geometry(&snapshot->camera), &snapshot->camera.last_geometry, blend);
+
+    for (size_t i = 0; i < snapshot->cnt; i++)
+    {
+        struct wg_internal* const wg = snapshot_widget(snapshot, i);
+
+        if (wg->last_timestamp == snapshot->timestamp)
+            geometry_blend(wg_geometry(wg), wg_geometry(wg), &wg->last_geometry, blend);
+    }
+}
+
+void widget_engine_snapshot_draw(size_t idx)
+{
+    struct widget_snapshot* const snapshot = widget_snapshots + idx;
+    const struct geometry* const view = wg_geometry(&snapshot->camera);
+
+    for (size_t i = 0; i < snapshot->cnt; i++)
+        draw_widget(view, snapshot_widget(snapshot, i));
+
+    if (snapshot->tabbed_out)
+    {
+        al_use_transform(&identity_transform);
+
+        ALLEGRO_DISPLAY* display = al_get_current_display();
+
+        al_draw_filled_rectangle(0, 0,
+            al_get_display_width(display), al_get_display_height(display),
+            al_map_rgba_f(0, 0, 0, 0.5));
+    }
+}
+
+// Pick against the snapshot as it was drawn, the main thread collects the result a frame or two later.
+void widget_engine_snapshot_pick(size_t idx)
+{
+    struct widget_snapshot* const snapshot = widget_snapshots + idx;
+    const struct geometry* const view = wg_geometry(&snapshot->camera);
+
+    if (snapshot->tabbed_out)
+        return;
+
+    ALLEGRO_BITMAP* const original_bitmap = pick_begin(snapshot->pick_x, snapshot->pick_y);
+
+    // Ids here index the snapshot rather than the widget table.
+    for (size_t i = 0; i < snapshot->cnt; i++)
+        if (snapshot->source[i] != snapshot->pick_hidden)
+            mask_widget(view, snapshot_widget(snapshot, i), i + 1);
+
+    const size_t index = pick_end(original_bitmap);
+
+    snapshot->picked = index != 0 && index <= snapshot->cnt ? snapshot->source[index - 1] : NULL;
+}
+
 // Update the widget engine, done while widget tweeners are processing.
 void widget_engine_update()
 {
     if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
         return;
 
-    update_drag_pointers();
+    update_drag_pointers(false);
 
     if (current_timestamp > transition_timestamp)
         switch (widget_engine_state)
@@ -1677,37 +2929,103 @@ void widget_engine_update()
     }
 }
 
-// Make a work queue with only the widgets that have an update method.
-struct work_queue* widget_engine_widget_work()
+// Remember where a widget starts the step so drawing can interpolate towards where it ends.
+static void wg_step_begin(struct wg_internal* wg)
 {
-    struct work_queue* work_queue = work_queue_create();
+    geometry_copy(&wg->last_geometry, wg_geometry(wg));
+    wg->last_timestamp = future_timestamp;
+}
 
-    if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
-        return work_queue;
+static void wg_bezier_update_range(size_t begin, size_t end, void* _)
+{
+    if (step_timestamp > 0)
+        for (size_t slot = begin; slot < end; slot++)
+            wg_step_begin(bezier_store.owner[slot]);
 
-    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
-        work_queue_push(work_queue, wg_bezier_update, zone);
+    bezier_update_range(begin, end);
+}
 
-    for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
-        for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
-            work_queue_push(work_queue, wg_bezier_update, piece);
+// Push the bezier update of every animating slot to the thread pool in contiguous batches.
+// The batches signal fence, doesn't wait for completion.
+void widget_engine_widget_work(struct thread_pool_fence* fence)
+{
+    if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
+        return;
 
-    for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
+    // With fixed steps the camera moves with the widgets rather than once per drawn frame.
+    if (step_timestamp > 0)
     {
-        work_queue_push(work_queue, wg_bezier_update, frame);
+        wg_step_begin(&camera);
+        wg_bezier_update(&camera);
+    }
 
-        for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
-            work_queue_push(work_queue, wg_bezier_update, hud);
+    // Drop the slots that reached their end last update.
+    for (size_t slot = 1; slot < bezier_store.active;)
+        if (bezier_store.t[slot] < current_timestamp)
+            bezier_swap(slot, --bezier_store.active);
+        else
+            slot++;
+
+    // Anything moving this update, the camera included, invalidates the last pick.
+    if (bezier_store.active > 1 || *wg_bezier_t(&camera) >= current_timestamp)
+        scene_version++;
+
+    thread_pool_parallel_for(1, bezier_store.active, 0, wg_bezier_update_range, NULL, fence);
+}
+
+// Reads the store rather than the last widget work so keyframes set since then keep the loop awake,
+// a slot only leaves the animating ones once an update has snapped it to its end.
+static bool engine_still()
+{
+    if (widget_engine_state != ENGINE_STATE_IDLE &&
+        widget_engine_state != ENGINE_STATE_HOVER)
+        return false;
+
+    return bezier_store.active == 1 && *wg_bezier_t(&camera) < current_timestamp;
+}
+
+// Whether nothing will change without input or a timer firing:
+// no widget or the camera is moving and the engine isn't part way through an interaction.
+bool widget_engine_idle()
+{
+    // Nothing is tweened while tabbed out, only the switch back in can change anything.
+    if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
+        return true;
+
+    if (!engine_still())
+        return false;
+
+    // The hover may have come from a read back of an earlier scene and the next one is only collected by another pick,
+    // settle it on the GPU now rather than sleep on a stale hover. Its callbacks may start something moving.
+    if (!snapshot_picking && !pick_cached(mouse_x, mouse_y))
+    {
+        update_drag_pointers(true);
+        return engine_still();
     }
 
-    return work_queue;
+    return true;
+}
+
+// Re-pick the hover and drop under the current mouse position without a full update.
+// Clicks act on the result, so this waits on the GPU rather than use a read back from elsewhere.
+void widget_engine_refresh_hover()
+{
+    if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
+        return;
+
+    update_drag_pointers(true);
 }
 
 // Handle events by calling all widgets that have a event handler.
+// Picks are only invalidated by real changes: a state transition, the camera moving or a widget reporting one.
+// Widget callbacks and lua invalidate them on their own through call_lua.
 void widget_engine_event_handler()
 {
     // TODO: Incorperate to the threadpool?
 
+    const int state = widget_engine_state;
+    bool changed = false;
+
     if (widget_engine_state == ENGINE_STATE_TABBED_OUT)
         if (current_event.type != ALLEGRO_EVENT_DISPLAY_SWITCH_IN)
             return;
@@ -1716,21 +3034,21 @@ void widget_engine_event_handler()
 
     for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
         if(zone->jumptable->event_handler)
-			zone->jumptable->event_handler(wg_public(zone));
+			changed |= zone->jumptable->event_handler(wg_public(zone));
 
     for (struct wg_internal* zone = root_board->head; zone; zone = zone->next)
         for (struct wg_internal* piece = zone->head; piece; piece = piece->next)
             if (piece->jumptable->event_handler)
-                piece->jumptable->event_handler(wg_public(piece));
+                changed |= piece->jumptable->event_handler(wg_public(piece));
 
     for (struct wg_internal* frame = root_hud->head; frame; frame = frame->next)
     {
         if (frame->jumptable->event_handler)
-            frame->jumptable->event_handler(wg_public(frame));
+            changed |= frame->jumptable->event_handler(wg_public(frame));
 
         for (struct wg_internal* hud = frame->head; hud; hud = hud->next)
             if (hud->jumptable->event_handler)
-                hud->jumptable->event_handler(wg_public(hud));
+                changed |= hud->jumptable->event_handler(wg_public(hud));
     }
 
     switch (current_event.type)
@@ -1771,7 +3089,7 @@ void widget_engine_event_handler()
             drag_offset_x = mouse_x - current_hover->dx;
             drag_offset_y = mouse_y - current_hover->dy;
 
-            geometry_copy(&drag_release,&current_hover->dest);
+            wg_bezier_get(current_hover, BEZIER_DEST, &drag_release);
         }
        
         break;
@@ -1791,6 +3109,8 @@ void widget_engine_event_handler()
 
             camera.sx = camera.sx < 0.2 ? 0.2 : camera.sx;
             camera.sy = camera.sy < 0.2 ? 0.2 : camera.sy;
+
+            changed |= current_event.mouse.dx || current_event.mouse.dy || current_event.mouse.dz;
         }
         else if (current_hover && (
             widget_engine_state == ENGINE_STATE_POST_DRAG_THRESHOLD
@@ -1805,6 +3125,9 @@ void widget_engine_event_handler()
 
         widget_engine_state = ENGINE_STATE_TABBED_OUT;
     }
+
+    if (changed || widget_engine_state != state)
+        scene_version++;
 }
 
 /*********************************************/
@@ -1838,13 +3161,13 @@ static int push_keyframe(lua_State* L)
 
     lua_getgeometry(-1, &geometry);
 
-    geometry_copy(&wg->dest, &geometry);
+    wg_bezier_put(wg, BEZIER_DEST, &geometry);
     lua_getfield(L, -1, "t");
 
     if (lua_type(lua_state, -1) == LUA_TNUMBER)
-        wg->t = lua_tonumber(lua_state, -1);
+        wg_bezier_until(wg, lua_tonumber(lua_state, -1));
     else
-        wg->t = current_timestamp;
+        wg_bezier_until(wg, current_timestamp);
 
     return 0;
 }
@@ -1897,6 +3220,11 @@ static int wg_gc(lua_State* L)
     // Make sure we don't get stale pointers
     prevent_stale_pointers(wg);
 
+    bezier_free(wg->slot);
+    pick_id_release(wg->pick_id);
+
+    scene_version++;
+
     //wg_remove(wg);
 
     return 0;
@@ -2056,6 +3384,8 @@ static int wg_newindex(lua_State* L)
 {
     struct wg_internal* const wg = (struct wg_internal*)luaL_checkudata(L, -3, "widget_mt");
 
+    scene_version++;
+
     if (lua_type(L, -2) == LUA_TSTRING)
     {
         const char* key = lua_tostring(L, -2);
@@ -2065,7 +3395,7 @@ static int wg_newindex(lua_State* L)
             if (!lua_isnumber(L, -1))
                 return -1;
 
-            wg->t = lua_tonumber(L, -1);
+            wg_bezier_until(wg, lua_tonumber(L, -1));
             return 0;
         }
         else if (strcmp("x", key) == 0)
@@ -2172,6 +3502,7 @@ void widget_engine_init()
 
     onscreen_shader_init();
     offscreen_shader_init();
+    pick_async_init();
 
     style_init();
     camera_init();
@@ -2229,7 +3560,13 @@ static struct wg_internal* wg_alloc(enum wg_type type, size_t size)
     if (!widget)
         return NULL;
 
-    *widget = (struct wg_internal){ .type = type };
+    *widget = (struct wg_internal){ .type = type, .size = size };
+
+    // Before the metatable so __gc only sees widgets with a slot.
+    if (!bezier_alloc(widget))
+        luaL_error(lua_state, "failed to allocate a bezier slot");
+
+    widget->pick_id = pick_id_alloc(widget);
 
     // Set metatable
     luaL_getmetatable(lua_state, "widget_mt");
@@ -2276,11 +3613,12 @@ struct wg_piece* wg_alloc_piece(size_t size, struct wg_jumptable_piece* jumptabl
     wg->snappable = false;
     wg->jumptable = (struct wg_jumptable_piece*)jumptable;
 
-    struct geometry geometry;
-    geometry_copy(&geometry, &wg->parent->dest);
+    struct geometry geometry, piece_dest;
+    wg_bezier_get(wg->parent, BEZIER_DEST, &geometry);
+    wg_bezier_get((struct wg_internal*)wg, BEZIER_DEST, &piece_dest);
 
-    geometry.hh = wg->dest.hh;
-    geometry.hw = wg->dest.hw;
+    geometry.hh = piece_dest.hh;
+    geometry.hw = piece_dest.hw;
 
     wg_bezier_set(wg, &geometry);
 
@@ -32,19 +32,20 @@ void lua_cleangeometry(int);
 
 struct wg_base
 {
-	// Current geometry
+	// Current geometry, the rest of its Bzier curve is kept by the widget engine
 	struct geometry;
 
-	// Bzier
-	struct geometry ctrl1;
-	struct geometry ctrl2;
-	struct geometry dest;
-	double t;
-
 	bool draggable;
 	bool snappable;
 };
 
+// Hit tests in widget coordinates
+bool wg_hit_rectangle(const struct wg_base* const, double, double);
+bool wg_hit_rounded_rectangle(const struct wg_base* const, double, double, double);
+bool wg_hit_rounded_box(double, double, double, double, double);
+bool wg_hit_ellipse(const struct wg_base* const, double, double);
+bool wg_hit_bitmap(const struct wg_base* const, ALLEGRO_BITMAP*, double, double, double, double);
+
 struct wg_zone
 {
 	struct wg_base;
@@ -89,8 +90,9 @@ struct wg_jumptable_base
 
 	void (*draw)(const struct wg_base* const);
 	void (*mask)(const struct wg_base* const);
+	bool (*hit)(const struct wg_base* const, double, double);
 
-	void (*event_handler)(struct wg_base* const);
+	bool (*event_handler)(struct wg_base* const);	// Returns true if the widget changed in a way picking can see
 	void (*default_geometry)(struct wg_base* const,struct geometry*);
 
 	void (*hover_start)(struct wg_base* const);